@@ -0,0 +1,612 @@
+#include "devices/ahci.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* This driver talks to SATA disks through an AHCI host bus
+   adapter, such as QEMU's ich9-ahci.  The HBA's registers are
+   memory-mapped.  Each port has a list of up to 32 command slots;
+   we fill in a slot's command header and command table, which
+   holds the command FIS and a scatter/gather list (PRDT), then
+   set the slot's bit in the port's command issue register.
+
+   With native command queuing (NCQ), the disk itself holds up to
+   32 commands, tagged by slot number, and completes them in
+   whatever order suits it.  As with virtio-blk, requests are not
+   queued in the block layer: any number of threads may each have
+   a command outstanding, up to the queue depth. */
+
+/* Generic host control registers, as offsets in bytes. */
+#define HBA_CAP 0x00            /* Host capabilities. */
+#define HBA_GHC 0x04            /* Global host control. */
+#define HBA_IS 0x08             /* Interrupt status, one bit per port. */
+#define HBA_PI 0x0c             /* Ports implemented. */
+
+/* HBA_CAP fields. */
+#define CAP_NCS(CAP) ((((CAP) >> 8) & 0x1f) + 1) /* Command slots. */
+#define CAP_SNCQ 0x40000000     /* Supports NCQ. */
+
+/* HBA_GHC bits. */
+#define GHC_IE 0x00000002       /* Interrupt enable. */
+#define GHC_AE 0x80000000       /* AHCI enable. */
+
+/* Port registers, as offsets in bytes from the port's base. */
+#define PORT_BASE(N) (0x100 + (N) * 0x80)
+#define PX_CLB 0x00             /* Command list base address. */
+#define PX_CLBU 0x04            /* Upper 32 bits of PX_CLB. */
+#define PX_FB 0x08              /* Received FIS base address. */
+#define PX_FBU 0x0c             /* Upper 32 bits of PX_FB. */
+#define PX_IS 0x10              /* Interrupt status. */
+#define PX_IE 0x14              /* Interrupt enable. */
+#define PX_CMD 0x18             /* Command and status. */
+#define PX_TFD 0x20             /* Task file data. */
+#define PX_SIG 0x24             /* Signature. */
+#define PX_SSTS 0x28            /* SATA status. */
+#define PX_SERR 0x30            /* SATA error. */
+#define PX_SACT 0x34            /* SATA active (NCQ tags). */
+#define PX_CI 0x38              /* Command issue. */
+
+/* PX_CMD bits. */
+#define CMD_ST 0x0001           /* Start processing command list. */
+#define CMD_FRE 0x0010          /* FIS receive enable. */
+#define CMD_FR 0x4000           /* FIS receive running. */
+#define CMD_CR 0x8000           /* Command list running. */
+
+/* PX_IS and PX_IE bits. */
+#define IS_DHRS 0x00000001      /* Device-to-host register FIS. */
+#define IS_PSS 0x00000002       /* PIO setup FIS. */
+#define IS_DSS 0x00000004       /* DMA setup FIS. */
+#define IS_SDBS 0x00000008      /* Set device bits FIS (NCQ done). */
+#define IS_ERRORS 0x78000000    /* Interface, host bus and task file
+                                   errors. */
+
+/* PX_TFD status bits. */
+#define TFD_BSY 0x80            /* Busy. */
+#define TFD_DRQ 0x08            /* Data request. */
+
+/* PX_SIG value of an ATA disk, and PX_SSTS device detection value
+   for a device that is present and communicating. */
+#define SIG_ATA 0x00000101
+#define SSTS_DET_PRESENT 3
+
+/* ATA commands that we use. */
+#define ATA_IDENTIFY 0xec               /* IDENTIFY DEVICE. */
+#define ATA_READ_DMA_EXT 0x25           /* READ DMA EXT. */
+#define ATA_WRITE_DMA_EXT 0x35          /* WRITE DMA EXT. */
+#define ATA_READ_FPDMA 0x60             /* READ FPDMA QUEUED. */
+#define ATA_WRITE_FPDMA 0x61            /* WRITE FPDMA QUEUED. */
+
+/* IDENTIFY DEVICE words that we look at. */
+#define ID_QUEUE_DEPTH 75       /* Low 5 bits: NCQ depth minus 1. */
+#define ID_SATA_CAP 76          /* Bit 8: supports NCQ. */
+#define ID_CMD_SET 83           /* Bit 10: supports 48-bit LBA. */
+#define ID_LBA28 60             /* 28-bit sector count, 2 words. */
+#define ID_LBA48 100            /* 48-bit sector count, 4 words. */
+
+/* A command header in a port's command list. */
+struct cmd_header
+  {
+    uint32_t flags;             /* FIS length, direction, PRDT length. */
+    uint32_t prdbc;             /* Bytes transferred. */
+    uint32_t ctba;              /* Command table address. */
+    uint32_t ctbau;             /* Upper 32 bits of CTBA. */
+    uint32_t reserved[4];
+  };
+#define CH_CFL(DWORDS) (DWORDS) /* Command FIS length in dwords. */
+#define CH_WRITE 0x00000040     /* Host to device data. */
+#define CH_PRDTL(N) ((uint32_t) (N) << 16) /* PRDT entries. */
+
+/* A PRDT entry, describing one region of memory. */
+struct prdt_entry
+  {
+    uint32_t dba;               /* Data base address, even. */
+    uint32_t dbau;              /* Upper 32 bits of DBA. */
+    uint32_t reserved;
+    uint32_t dbc;               /* Byte count minus 1, even length. */
+  };
+
+/* Most sectors moved by a single command, which is also the most
+   PRDT entries that a command needs. */
+#define AHCI_MAX_SECTORS 32
+
+/* A command table.  Must be 128-byte aligned; its size is a
+   multiple of 128 bytes, so an array of them that starts on a
+   page boundary is. */
+struct cmd_table
+  {
+    uint8_t cfis[64];           /* Command FIS. */
+    uint8_t acmd[16];           /* ATAPI command, unused. */
+    uint8_t reserved[48];
+    struct prdt_entry prdt[AHCI_MAX_SECTORS];
+  };
+
+/* Host to device register FIS. */
+struct fis_h2d
+  {
+    uint8_t type;               /* FIS_TYPE_H2D. */
+    uint8_t flags;              /* FIS_COMMAND for a command. */
+    uint8_t command;
+    uint8_t feature_lo;
+    uint8_t lba0, lba1, lba2;
+    uint8_t device;
+    uint8_t lba3, lba4, lba5;
+    uint8_t feature_hi;
+    uint8_t count_lo, count_hi;
+    uint8_t icc;
+    uint8_t control;
+    uint8_t reserved[4];
+  };
+#define FIS_TYPE_H2D 0x27
+#define FIS_COMMAND 0x80
+#define FIS_DEV_LBA 0x40
+
+/* Number of command slots in a port's command list. */
+#define SLOT_CNT 32
+
+/* A command waiting for completion.  Lives on the stack of the
+   thread that issued it. */
+struct ahci_request
+  {
+    struct semaphore done;      /* Up'd by interrupt handler. */
+  };
+
+/* A SATA disk on a port of the HBA. */
+struct ahci_disk
+  {
+    char name[8];               /* Name, e.g. "sda". */
+    int port_no;                /* Port number. */
+    bool ncq;                   /* Using native command queuing? */
+    int slot_cnt;               /* Command slots we may use. */
+
+    struct cmd_header *cmd_list; /* Command list. */
+    struct cmd_table *tables;   /* A command table for each slot. */
+
+    struct lock lock;           /* Protects BUSY. */
+    struct condition slot_freed; /* Signaled when a slot frees up. */
+    uint32_t busy;              /* Slots in use. */
+
+    /* Slots issued to the disk.  Changed only with interrupts
+       off. */
+    uint32_t issued;
+    struct ahci_request *requests[SLOT_CNT]; /* Request in each slot. */
+  };
+
+/* Memory-mapped HBA registers. */
+static volatile uint8_t *hba;
+
+/* We support up to eight disks, "sda" through "sdh". */
+#define DISK_CNT 8
+static struct ahci_disk disks[DISK_CNT];
+static size_t disk_cnt;
+
+/* Disk attached to each port, if any. */
+static struct ahci_disk *port_disks[32];
+
+static struct block_operations ahci_operations;
+
+static bool init_port (struct ahci_disk *);
+static void identify_disk (struct ahci_disk *);
+static void issue (struct ahci_disk *, uint8_t command, block_sector_t,
+                   size_t cnt, void *const buffers[], bool write);
+static void interrupt_handler (struct intr_frame *);
+
+/* Returns the HBA register at byte offset REG. */
+static uint32_t
+hba_read (uint32_t reg)
+{
+  return *(volatile uint32_t *) (hba + reg);
+}
+
+/* Sets the HBA register at byte offset REG to VALUE. */
+static void
+hba_write (uint32_t reg, uint32_t value)
+{
+  *(volatile uint32_t *) (hba + reg) = value;
+}
+
+/* Returns register REG of disk D's port. */
+static uint32_t
+port_read (const struct ahci_disk *d, uint32_t reg)
+{
+  return hba_read (PORT_BASE (d->port_no) + reg);
+}
+
+/* Sets register REG of disk D's port to VALUE. */
+static void
+port_write (const struct ahci_disk *d, uint32_t reg, uint32_t value)
+{
+  hba_write (PORT_BASE (d->port_no) + reg, value);
+}
+
+/* Waits up to a second for the bits in MASK to clear in register
+   REG of disk D's port.  Returns true if they did. */
+static bool
+port_wait_clear (const struct ahci_disk *d, uint32_t reg, uint32_t mask)
+{
+  int i;
+
+  for (i = 0; i < 1000; i++)
+    {
+      if ((port_read (d, reg) & mask) == 0)
+        return true;
+      timer_msleep (1);
+    }
+  return false;
+}
+
+/* Finds the first AHCI host bus adapter and registers the disks
+   attached to it. */
+void
+ahci_init (void)
+{
+  struct pci_dev p;
+  uint32_t bar, cap, ports;
+  uint8_t irq;
+  int port_no;
+
+  if (!pci_find_class (0x01, 0x06, &p)
+      || ((pci_read_config (&p, PCI_REG_CLASS) >> 8) & 0xff) != 0x01)
+    return;
+
+  /* BAR 5 holds the HBA's registers. */
+  bar = pci_get_bar (&p, 5);
+  irq = pci_read_config (&p, PCI_REG_IRQ) & 0xff;
+  if ((bar & PCI_BAR_IO) || irq >= 16)
+    {
+      printf ("ahci: unusable PCI configuration, ignoring\n");
+      return;
+    }
+  pci_enable (&p, PCI_CMD_MEM | PCI_CMD_MASTER);
+  hba = pci_map_mem (bar & PCI_BAR_MEM_MASK, PORT_BASE (32));
+  hba_write (HBA_GHC, hba_read (HBA_GHC) | GHC_AE);
+  pci_register_irq (irq, interrupt_handler, "ahci");
+
+  cap = hba_read (HBA_CAP);
+  ports = hba_read (HBA_PI);
+  for (port_no = 0; port_no < 32 && disk_cnt < DISK_CNT; port_no++)
+    {
+      struct ahci_disk *d = &disks[disk_cnt];
+
+      if (!(ports & (1u << port_no)))
+        continue;
+      snprintf (d->name, sizeof d->name, "sd%c", 'a' + (int) disk_cnt);
+      d->port_no = port_no;
+      d->slot_cnt = CAP_NCS (cap);
+      d->ncq = (cap & CAP_SNCQ) != 0;
+      if (!init_port (d))
+        continue;
+
+      disk_cnt++;
+      port_disks[port_no] = d;
+      if (disk_cnt == 1)
+        {
+          hba_write (HBA_IS, hba_read (HBA_IS));
+          hba_write (HBA_GHC, hba_read (HBA_GHC) | GHC_IE);
+        }
+      identify_disk (d);
+    }
+}
+
+/* Brings up the port of disk D, whose PORT_NO, SLOT_CNT and NCQ
+   members must be set, if an ATA disk is attached to it.
+   Returns true if successful, false if there is no disk or the
+   port does not respond. */
+static bool
+init_port (struct ahci_disk *d)
+{
+  size_t table_pages = DIV_ROUND_UP (SLOT_CNT * sizeof *d->tables, PGSIZE);
+  uint8_t *base;
+  int i;
+
+  if ((port_read (d, PX_SSTS) & 0xf) != SSTS_DET_PRESENT
+      || port_read (d, PX_SIG) != SIG_ATA)
+    return false;
+
+  /* Stop the port before moving its command list. */
+  port_write (d, PX_CMD, port_read (d, PX_CMD) & ~CMD_ST);
+  if (!port_wait_clear (d, PX_CMD, CMD_CR))
+    goto timeout;
+  port_write (d, PX_CMD, port_read (d, PX_CMD) & ~CMD_FRE);
+  if (!port_wait_clear (d, PX_CMD, CMD_FR))
+    goto timeout;
+
+  /* The first page holds the 1 kB command list and then the
+     received FIS area; the command tables follow. */
+  base = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, 1 + table_pages);
+  d->cmd_list = (struct cmd_header *) base;
+  d->tables = (struct cmd_table *) (base + PGSIZE);
+  for (i = 0; i < SLOT_CNT; i++)
+    d->cmd_list[i].ctba = vtop (&d->tables[i]);
+  port_write (d, PX_CLB, vtop (d->cmd_list));
+  port_write (d, PX_CLBU, 0);
+  port_write (d, PX_FB, vtop (base + SLOT_CNT * sizeof *d->cmd_list));
+  port_write (d, PX_FBU, 0);
+
+  lock_init (&d->lock);
+  cond_init (&d->slot_freed);
+  d->busy = 0;
+  d->issued = 0;
+
+  /* Clear stale errors and interrupts, then start the port. */
+  port_write (d, PX_SERR, 0xffffffff);
+  port_write (d, PX_IS, 0xffffffff);
+  port_write (d, PX_IE, IS_DHRS | IS_PSS | IS_DSS | IS_SDBS | IS_ERRORS);
+  port_write (d, PX_CMD, port_read (d, PX_CMD) | CMD_FRE);
+  port_write (d, PX_CMD, port_read (d, PX_CMD) | CMD_ST);
+  if (!port_wait_clear (d, PX_TFD, TFD_BSY | TFD_DRQ))
+    {
+      palloc_free_multiple (base, 1 + table_pages);
+      goto timeout;
+    }
+  return true;
+
+ timeout:
+  printf ("%s: port %d not responding, ignoring\n", d->name, d->port_no);
+  return false;
+}
+
+/* Reads disk D's identity, decides whether to use NCQ, and
+   registers it with the block layer. */
+static void
+identify_disk (struct ahci_disk *d)
+{
+  uint16_t *id = palloc_get_page (PAL_ASSERT);
+  void *buffer = id;
+  uint64_t capacity;
+  char extra_info[32];
+  struct block *block;
+
+  issue (d, ATA_IDENTIFY, 0, 1, &buffer, false);
+  if (id[ID_CMD_SET] & 0x0400)
+    capacity = (id[ID_LBA48] | (uint32_t) id[ID_LBA48 + 1] << 16
+                | (uint64_t) id[ID_LBA48 + 2] << 32
+                | (uint64_t) id[ID_LBA48 + 3] << 48);
+  else
+    capacity = id[ID_LBA28] | (uint32_t) id[ID_LBA28 + 1] << 16;
+
+  /* Queue no more commands than both the HBA and the disk can
+     hold. */
+  if (d->ncq && (id[ID_SATA_CAP] & 0x0100))
+    {
+      int depth = (id[ID_QUEUE_DEPTH] & 0x1f) + 1;
+      if (d->slot_cnt > depth)
+        d->slot_cnt = depth;
+      snprintf (extra_info, sizeof extra_info, "AHCI, NCQ depth %d",
+                d->slot_cnt);
+    }
+  else
+    {
+      d->ncq = false;
+      strlcpy (extra_info, "AHCI", sizeof extra_info);
+    }
+  palloc_free_page (id);
+
+  if (capacity > (block_sector_t) -1)
+    {
+      printf ("%s: ignoring disk too large to address\n", d->name);
+      return;
+    }
+  block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
+                          &ahci_operations, d);
+  partition_scan (block);
+}
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFERS.  Runs of up to AHCI_MAX_SECTORS sectors are
+   moved by a single command.  Internally synchronizes accesses
+   to disks, so external per-disk locking is unneeded. */
+static void
+ahci_read_multi (void *d_, block_sector_t sec_no, size_t cnt,
+                 void *const buffers[])
+{
+  struct ahci_disk *d = d_;
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < AHCI_MAX_SECTORS ? cnt : AHCI_MAX_SECTORS;
+      issue (d, d->ncq ? ATA_READ_FPDMA : ATA_READ_DMA_EXT,
+             sec_no, n, buffers, false);
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   from BUFFERS.  Returns after the disk has acknowledged
+   receiving the data.  Internally synchronizes accesses to
+   disks, so external per-disk locking is unneeded. */
+static void
+ahci_write_multi (void *d_, block_sector_t sec_no, size_t cnt,
+                  const void *const buffers[])
+{
+  struct ahci_disk *d = d_;
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < AHCI_MAX_SECTORS ? cnt : AHCI_MAX_SECTORS;
+      issue (d, d->ncq ? ATA_WRITE_FPDMA : ATA_WRITE_DMA_EXT,
+             sec_no, n, (void *const *) buffers, true);
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ahci_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ahci_read_multi (d, sec_no, 1, &buffer);
+}
+
+/* Writes sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes. */
+static void
+ahci_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ahci_write_multi (d, sec_no, 1, &buffer);
+}
+
+static struct block_operations ahci_operations =
+  {
+    ahci_read,
+    ahci_write,
+    ahci_read_multi,
+    ahci_write_multi,
+    NULL
+  };
+
+/* Issues ATA COMMAND for the CNT sectors starting at SEC_NO to
+   disk D, with data moving between the disk and BUFFERS in the
+   direction given by WRITE, and waits for it to complete.  The
+   PRDT merges buffers that are physically adjacent. */
+static void
+issue (struct ahci_disk *d, uint8_t command, block_sector_t sec_no,
+       size_t cnt, void *const buffers[], bool write)
+{
+  bool queued = command == ATA_READ_FPDMA || command == ATA_WRITE_FPDMA;
+  struct ahci_request r;
+  struct cmd_table *t;
+  struct fis_h2d *fis;
+  enum intr_level old_level;
+  size_t prd_cnt = 0;
+  uint32_t bit;
+  int slot;
+  size_t i;
+
+  ASSERT (cnt >= 1 && cnt <= AHCI_MAX_SECTORS);
+
+  /* Claim a free slot. */
+  lock_acquire (&d->lock);
+  for (;;)
+    {
+      for (slot = 0; slot < d->slot_cnt; slot++)
+        if (!(d->busy & (1u << slot)))
+          break;
+      if (slot < d->slot_cnt)
+        break;
+      cond_wait (&d->slot_freed, &d->lock);
+    }
+  bit = 1u << slot;
+  d->busy |= bit;
+  lock_release (&d->lock);
+
+  /* Describe the data. */
+  t = &d->tables[slot];
+  for (i = 0; i < cnt; i++)
+    {
+      uint32_t addr = vtop (buffers[i]);
+      struct prdt_entry *last = prd_cnt > 0 ? &t->prdt[prd_cnt - 1] : NULL;
+
+      ASSERT ((addr & 1) == 0);
+      if (last != NULL && last->dba + last->dbc + 1 == addr)
+        last->dbc += BLOCK_SECTOR_SIZE;
+      else
+        {
+          struct prdt_entry *e = &t->prdt[prd_cnt++];
+          e->dba = addr;
+          e->dbau = 0;
+          e->dbc = BLOCK_SECTOR_SIZE - 1;
+        }
+    }
+
+  /* Build the command FIS.  NCQ commands carry the sector count
+     in the feature field and the slot number, as the tag, in the
+     count field. */
+  fis = (struct fis_h2d *) t->cfis;
+  memset (fis, 0, sizeof *fis);
+  fis->type = FIS_TYPE_H2D;
+  fis->flags = FIS_COMMAND;
+  fis->command = command;
+  if (command != ATA_IDENTIFY)
+    {
+      fis->lba0 = sec_no;
+      fis->lba1 = sec_no >> 8;
+      fis->lba2 = sec_no >> 16;
+      fis->lba3 = sec_no >> 24;
+      fis->device = FIS_DEV_LBA;
+      if (queued)
+        {
+          fis->feature_lo = cnt & 0xff;
+          fis->feature_hi = cnt >> 8;
+          fis->count_lo = slot << 3;
+        }
+      else
+        {
+          fis->count_lo = cnt & 0xff;
+          fis->count_hi = cnt >> 8;
+        }
+    }
+  d->cmd_list[slot].flags = (CH_CFL (sizeof *fis / 4)
+                             | (write ? CH_WRITE : 0) | CH_PRDTL (prd_cnt));
+  d->cmd_list[slot].prdbc = 0;
+
+  /* Issue the command.  NCQ commands must be marked active
+     first. */
+  sema_init (&r.done, 0);
+  d->requests[slot] = &r;
+  barrier ();
+  old_level = intr_disable ();
+  d->issued |= bit;
+  if (queued)
+    port_write (d, PX_SACT, bit);
+  port_write (d, PX_CI, bit);
+  intr_set_level (old_level);
+
+  sema_down (&r.done);
+
+  lock_acquire (&d->lock);
+  d->busy &= ~bit;
+  cond_signal (&d->slot_freed, &d->lock);
+  lock_release (&d->lock);
+}
+
+/* AHCI interrupt handler.  Wakes up the thread waiting for each
+   command that has completed.  A command is complete once the
+   disk has cleared its bit in both the command issue register
+   and, for NCQ commands, the SATA active register. */
+static void
+interrupt_handler (struct intr_frame *f UNUSED)
+{
+  uint32_t is = hba_read (HBA_IS);
+  int port_no;
+
+  /* The interrupt line may be shared with another device. */
+  if (is == 0)
+    return;
+
+  for (port_no = 0; port_no < 32; port_no++)
+    {
+      struct ahci_disk *d = port_disks[port_no];
+      uint32_t port_is, done;
+      int slot;
+
+      if (!(is & (1u << port_no)))
+        continue;
+      port_is = hba_read (PORT_BASE (port_no) + PX_IS);
+      hba_write (PORT_BASE (port_no) + PX_IS, port_is);
+      if (d == NULL)
+        continue;
+      if (port_is & IS_ERRORS)
+        PANIC ("%s: command failed, task file %#"PRIx32,
+               d->name, port_read (d, PX_TFD));
+
+      done = d->issued & ~(port_read (d, PX_SACT) | port_read (d, PX_CI));
+      d->issued &= ~done;
+      for (slot = 0; slot < SLOT_CNT; slot++)
+        if (done & (1u << slot))
+          sema_up (&d->requests[slot]->done);
+    }
+  hba_write (HBA_IS, is);
+}
@@ -4,6 +4,12 @@
 #include <stdio.h>
 #include "devices/ide.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Most sectors that the dispatcher moves in one merged
+   transfer. */
+#define MERGE_MAX 64
 
 /* A block device. */
 struct block
@@ -19,6 +25,22 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    bool claimed;                       /* Member of a layered device? */
+
+    /* Request queue, if block_enable_queue() was called. */
+    bool queued;                        /* Requests go through queue? */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct condition queue_ready;       /* Signaled when queue nonempty. */
+    struct list queue;                  /* Pending requests by sector. */
+    block_sector_t head;                /* Sector after last transfer. */
+    block_sector_t busy_sector;         /* First sector being transferred. */
+    size_t busy_cnt;                    /* Number of sectors being
+                                           transferred, or 0. */
+    bool busy_write;                    /* Transfer is a write? */
+    size_t depth;                       /* Number of requests in queue. */
+    size_t max_depth;                   /* Largest depth seen. */
+    unsigned long long request_cnt;     /* Number of requests queued. */
+    unsigned long long merge_cnt;       /* Requests merged into others. */
   };
 
 /* List of all block devices. */
@@ -28,6 +50,14 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static bool overlaps_pending (struct block *, block_sector_t, size_t cnt,
+                              bool write) UNUSED;
+static void transfer (struct block *, block_sector_t, size_t cnt, bool write,
+                      void *const buffers[]);
+static bool request_less (const struct list_elem *,
+                          const struct list_elem *, void *aux);
+static void finish (struct block_request *);
+static thread_func dispatcher NO_RETURN;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +150,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multi (block, sector, 1, &buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +161,121 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multi (block, sector, 1, &buffer);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK,
+   each into the corresponding element of BUFFERS, which must
+   have room for BLOCK_SECTOR_SIZE bytes.  Devices that support
+   it move all of the sectors with a single request.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multi (struct block *block, block_sector_t sector, size_t cnt,
+                  void *const buffers[])
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  r.sector = sector;
+  r.cnt = cnt;
+  r.write = false;
+  r.buffers = buffers;
+  r.complete = NULL;
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK,
+   each from the corresponding element of BUFFERS, which must
+   contain BLOCK_SECTOR_SIZE bytes.  Returns after the block
+   device has acknowledged receiving the data.  Devices that
+   support it move all of the sectors with a single request.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multi (struct block *block, block_sector_t sector, size_t cnt,
+                   const void *const buffers[])
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  r.sector = sector;
+  r.cnt = cnt;
+  r.write = true;
+  r.buffers = (void *const *) buffers;
+  r.complete = NULL;
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Starts transferring R->CNT consecutive sectors starting at
+   R->SECTOR between BLOCK and R->BUFFERS, reading if R->WRITE is
+   false and writing if it is true, and returns without waiting
+   for the transfer to finish unless BLOCK's driver cannot
+   transfer in the background.
+
+   When the transfer is complete, calls R->COMPLETE(R) if
+   R->COMPLETE is nonnull; the callback then owns R again, and
+   may free it.  It runs in a block device's dispatcher thread,
+   so it may take locks but should not sleep for long.
+   Otherwise, wakes up block_wait(), which must be called once.
+   Either way, R and its buffers must stay valid until then.
+
+   A queued device serves requests in sector order, not in the
+   order they were submitted, so R must not overlap a request
+   that is still pending on the same device unless both only
+   read.  Debug builds check this. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  if (r->cnt > 0)
+    {
+      check_sector (block, r->sector);
+      check_sector (block, r->sector + r->cnt - 1);
+    }
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN || block->claimed);
+
+  sema_init (&r->done, 0);
+  r->dev_sector = r->sector;
+  for (;;)
+    {
+      if (r->write)
+        block->write_cnt += r->cnt;
+      else
+        block->read_cnt += r->cnt;
+      if (block->queued || block->ops->lower == NULL)
+        break;
+      block = block->ops->lower (block->aux, &r->dev_sector);
+    }
+
+  if (r->cnt == 0 || !block->queued)
+    {
+      if (r->cnt > 0)
+        transfer (block, r->dev_sector, r->cnt, r->write, r->buffers);
+      finish (r);
+      return;
+    }
+
+  lock_acquire (&block->queue_lock);
+  ASSERT (!overlaps_pending (block, r->dev_sector, r->cnt, r->write));
+  list_insert_ordered (&block->queue, &r->elem, request_less, NULL);
+  block->request_cnt++;
+  if (++block->depth > block->max_depth)
+    block->max_depth = block->depth;
+  cond_signal (&block->queue_ready, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Waits for R, which was passed to block_submit() with a null
+   completion callback, to complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->complete == NULL);
+  sema_down (&r->done);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,10 +299,32 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Claims BLOCK as a member of a device layered on top of it, such
+   as a striped array, so that the layered device may write to it
+   even if it is foreign.  Returns false if BLOCK was already
+   claimed or has been assigned a role. */
+bool
+block_claim (struct block *block)
+{
+  enum block_type role;
+
+  if (block->claimed)
+    return false;
+  for (role = 0; role < BLOCK_ROLE_CNT; role++)
+    if (block_by_role[role] == block)
+      return false;
+  block->claimed = true;
+  return true;
+}
+
+/* Prints statistics for each block device used for a Pintos
+   role, and for each request queue.  Roles are usually played by
+   partitions, whose requests are queued on the disk that holds
+   them. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -176,6 +337,16 @@ block_print_stats (void)
                   block->read_cnt, block->write_cnt);
         }
     }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      if (block->queued)
+        printf ("%s: %llu requests, %llu merged, max queue depth %zu\n",
+                block->name, block->request_cnt, block->merge_cnt,
+                block->max_depth);
+    }
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -200,6 +371,8 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->claimed = false;
+  block->queued = false;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +384,205 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Gives BLOCK a request queue served by a dispatcher thread of
+   its own.  The dispatcher takes requests in C-LOOK order,
+   sweeping upward across the device and then jumping back to the
+   lowest pending sector, and merges requests for adjacent
+   sectors into a single transfer.  Drivers for devices that seek
+   should call this right after block_register(); devices layered
+   on top of another block device, such as partitions, should
+   not, since their requests are queued on the device below.
+   Without a queue, block_submit() transfers synchronously. */
+void
+block_enable_queue (struct block *block)
+{
+  ASSERT (!block->queued);
+
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_ready);
+  list_init (&block->queue);
+  block->head = 0;
+  block->busy_cnt = 0;
+  block->depth = 0;
+  block->max_depth = 0;
+  block->request_cnt = 0;
+  block->merge_cnt = 0;
+  block->queued = true;
+  thread_create (block->name, PRI_MAX, dispatcher, block);
+}
+
+/* Has BLOCK's driver transfer CNT sectors starting at SECTOR to
+   or from BUFFERS, in a single request if the driver supports
+   it. */
+static void
+transfer (struct block *block, block_sector_t sector, size_t cnt, bool write,
+          void *const buffers[])
+{
+  size_t i;
+
+  if (write)
+    {
+      if (block->ops->write_multi != NULL)
+        block->ops->write_multi (block->aux, sector, cnt,
+                                 (const void *const *) buffers);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->write (block->aux, sector + i, buffers[i]);
+    }
+  else
+    {
+      if (block->ops->read_multi != NULL)
+        block->ops->read_multi (block->aux, sector, cnt, buffers);
+      else
+        for (i = 0; i < cnt; i++)
+          block->ops->read (block->aux, sector + i, buffers[i]);
+    }
+}
+
+/* Returns true if request A_ starts below request B_. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+
+  return a->dev_sector < b->dev_sector;
+}
+
+/* Reports that R is complete. */
+static void
+finish (struct block_request *r)
+{
+  if (r->complete != NULL)
+    r->complete (r);
+  else
+    sema_up (&r->done);
+}
+
+/* Removes and returns the next request in BLOCK's queue in
+   C-LOOK order: the first one at or above the head position, or
+   the lowest one if none is.  BLOCK's queue lock must be held
+   and its queue must be nonempty. */
+static struct block_request *
+next_request (struct block *block)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    if (list_entry (e, struct block_request, elem)->dev_sector
+        >= block->head)
+      break;
+  if (e == list_end (&block->queue))
+    e = list_begin (&block->queue);
+  block->depth--;
+  return list_entry (list_remove (e), struct block_request, elem);
+}
+
+/* Dispatcher thread for BLOCK_, a struct block.  Takes requests
+   from the block's queue, merges each with the requests for the
+   sectors that follow it, hands them to the driver, and, once
+   the driver returns, completes them. */
+static void
+dispatcher (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct list batch;
+      struct block_request *first;
+      void *buffers[MERGE_MAX];
+      void *const *merged;
+      block_sector_t sector;
+      size_t cnt;
+
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_ready, &block->queue_lock);
+
+      /* Merge requests in the same direction that continue where
+         the previous one left off.  The queue is sorted, so they
+         directly follow the first request. */
+      list_init (&batch);
+      first = next_request (block);
+      list_push_back (&batch, &first->elem);
+      sector = first->dev_sector;
+      cnt = first->cnt;
+      merged = first->buffers;
+      if (cnt < MERGE_MAX)
+        {
+          struct list_elem *e = list_begin (&block->queue);
+          size_t i;
+
+          for (i = 0; i < cnt; i++)
+            buffers[i] = first->buffers[i];
+          while (e != list_end (&block->queue))
+            {
+              struct block_request *r
+                = list_entry (e, struct block_request, elem);
+              if (r->dev_sector > sector + cnt)
+                break;
+              e = list_next (e);
+              if (r->dev_sector == sector + cnt && r->write == first->write
+                  && cnt + r->cnt <= MERGE_MAX)
+                {
+                  list_remove (&r->elem);
+                  list_push_back (&batch, &r->elem);
+                  for (i = 0; i < r->cnt; i++)
+                    buffers[cnt++] = r->buffers[i];
+                  block->depth--;
+                  block->merge_cnt++;
+                }
+            }
+          merged = buffers;
+        }
+      block->head = sector + cnt;
+      block->busy_sector = sector;
+      block->busy_cnt = cnt;
+      block->busy_write = first->write;
+      lock_release (&block->queue_lock);
+
+      transfer (block, sector, cnt, first->write, merged);
+
+      lock_acquire (&block->queue_lock);
+      block->busy_cnt = 0;
+      lock_release (&block->queue_lock);
+      while (!list_empty (&batch))
+        {
+          struct block_request *r = list_entry (list_pop_front (&batch),
+                                                struct block_request, elem);
+          finish (r);
+        }
+    }
+}
+
+/* Returns true if the CNT sectors starting at SECTOR overlap a
+   request in BLOCK's queue or the transfer in progress, and
+   either that request or the new one, a write if WRITE is true,
+   changes the sectors.  BLOCK's queue lock must be held. */
+static bool
+overlaps_pending (struct block *block, block_sector_t sector, size_t cnt,
+                  bool write)
+{
+  struct list_elem *e;
+
+  if (block->busy_cnt > 0 && (write || block->busy_write)
+      && sector < block->busy_sector + block->busy_cnt
+      && block->busy_sector < sector + cnt)
+    return true;
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if ((write || r->write)
+          && sector < r->dev_sector + r->cnt && r->dev_sector < sector + cnt)
+        return true;
+    }
+  return false;
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
@@ -1,8 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,8 +56,37 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t, size_t cnt,
+                       void *const buffers[]);
+void block_write_multi (struct block *, block_sector_t, size_t cnt,
+                        const void *const buffers[]);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
+bool block_claim (struct block *);
+
+/* Asynchronous I/O. */
+struct block_request;
+typedef void block_callback (struct block_request *);
+
+/* A request to transfer consecutive sectors. */
+struct block_request
+  {
+    /* Filled in by the submitter. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    bool write;                         /* Write, as opposed to read? */
+    void *const *buffers;               /* One buffer per sector. */
+    block_callback *complete;           /* Completion callback or null. */
+    void *aux;                          /* For use by COMPLETE. */
+
+    /* Owned by the block layer. */
+    struct list_elem elem;              /* Element in a request queue. */
+    block_sector_t dev_sector;          /* SECTOR on the queueing device. */
+    struct semaphore done;              /* Upped on completion. */
+  };
+
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
 
 /* Statistics. */
 void block_print_stats (void);
@@ -65,10 +97,25 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors, each to or
+       from the corresponding element of BUFFERS, as a single
+       request.  If null, the block layer calls read or write
+       once per sector instead. */
+    void (*read_multi) (void *aux, block_sector_t, size_t cnt,
+                        void *const buffers[]);
+    void (*write_multi) (void *aux, block_sector_t, size_t cnt,
+                         const void *const buffers[]);
+
+    /* Optional.  For a device that is a window onto another block
+       device, returns that device and translates *SECTOR into its
+       sectors, so that requests can be queued there. */
+    struct block *(*lower) (void *aux, block_sector_t *sector);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_enable_queue (struct block *);
 
 #endif /* devices/block.h */
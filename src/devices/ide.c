@@ -5,13 +5,21 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].  Data moves by
+   PCI bus-master DMA, as described in [SFF-8038i], when the
+   controller and disk support it, and by PIO otherwise. */
+
+/* If true, never use DMA, even if it is available.
+   Controlled by kernel command-line option "-pio". */
+bool ide_pio_only;
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +38,27 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master port addresses. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BMC_START 0x01          /* Start transfer. */
+#define BMC_READ 0x08           /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits.  Writing 1 clears ERROR and
+   INTR. */
+#define BMS_ACTIVE 0x01         /* Transfer in progress. */
+#define BMS_ERROR 0x02          /* Transfer failed. */
+#define BMS_INTR 0x04           /* Disk raised its interrupt. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
+#define STA_DF 0x20             /* Device Fault. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +74,34 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA with retries. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA with retries. */
+
+/* IDENTIFY DEVICE capabilities word, and its bit that says the
+   disk supports DMA. */
+#define ID_CAPABILITIES 49
+#define ID_CAP_DMA 0x0100
+
+/* A physical region descriptor, which tells the bus master where
+   in memory to move part of a transfer.  A region must not cross
+   a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, even. */
+    uint16_t size;              /* Byte count, even; 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last entry. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Most sectors moved by a single command.  ATA allows up to
+   256, but this bounds the size of the PRD table. */
+#define IDE_MAX_SECTORS 32
+
+/* Number of entries in a channel's PRD table, enough for
+   IDE_MAX_SECTORS scattered sectors that each cross a 64 kB
+   boundary.  Each table is aligned to its own size so that it
+   never crosses a 64 kB boundary, as the bus master requires. */
+#define PRD_CNT (2 * IDE_MAX_SECTORS)
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +110,7 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool use_dma;               /* Transfer data by DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -66,6 +120,9 @@ struct channel
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus master base I/O port, or 0 if
+                                   DMA is unavailable. */
+    struct prd *prdt;           /* PRD table for DMA transfers. */
 
     struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
@@ -78,17 +135,26 @@ struct channel
 /* We support the two "legacy" ATA channels found in a standard PC. */
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
+static struct prd prd_tables[CHANNEL_CNT][PRD_CNT]
+  __attribute__ ((aligned (PRD_CNT * sizeof (struct prd))));
 
 static struct block_operations ide_operations;
 
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static uint16_t find_bus_master (void);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static void pio_read (struct ata_disk *, block_sector_t, size_t cnt,
+                      void *const buffers[]);
+static void pio_write (struct ata_disk *, block_sector_t, size_t cnt,
+                       const void *const buffers[]);
+static bool dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *const buffers[], bool read);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -101,6 +167,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -123,6 +190,8 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->prdt = prd_tables[chan_no];
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
@@ -136,6 +205,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->use_dma = false;
         }
 
       /* Register interrupt handler. */
@@ -159,6 +229,27 @@ ide_init (void)
 
 static char *descramble_ata_string (char *, int size);
 
+/* Finds the PCI IDE controller and enables it as a bus master.
+   Returns the base I/O port of its bus master registers, or 0 if
+   there is no such controller or DMA has been disabled, in which
+   case all transfers use PIO. */
+static uint16_t
+find_bus_master (void)
+{
+  struct pci_dev p;
+  uint32_t bar;
+
+  if (ide_pio_only || !pci_find_class (0x01, 0x01, &p))
+    return 0;
+
+  /* BAR 4 holds the bus master registers. */
+  bar = pci_get_bar (&p, 4);
+  if (!(bar & PCI_BAR_IO) || (bar & ~3u) == 0)
+    return 0;
+  pci_enable (&p, PCI_CMD_IO | PCI_CMD_MASTER);
+  return bar & ~3u;
+}
+
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
 static void
@@ -284,6 +375,8 @@ identify_ata_device (struct ata_disk *d)
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
+  d->use_dma = (c->bm_base != 0
+                && (*(uint16_t *) &id[ID_CAPABILITIES * 2] & ID_CAP_DMA));
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
@@ -306,6 +399,7 @@ identify_ata_device (struct ata_disk *d)
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  block_enable_queue (block);
   partition_scan (block);
 }
 
@@ -337,63 +431,144 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D,
+   each into the corresponding element of BUFFERS, which must
+   have room for BLOCK_SECTOR_SIZE bytes.  Runs of up to
+   IDE_MAX_SECTORS sectors are moved by a single command.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multi (void *d_, block_sector_t sec_no, size_t cnt,
+                void *const buffers[])
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t n = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+      if (!d->use_dma || !dma_transfer (d, sec_no, n, buffers, true))
+        pio_read (d, sec_no, n, buffers);
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D,
+   each from the corresponding element of BUFFERS, which must
+   contain BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
    acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multi (void *d_, block_sector_t sec_no, size_t cnt,
+                 const void *const buffers[])
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t n = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+      if (!d->use_dma
+          || !dma_transfer (d, sec_no, n, (void *const *) buffers, false))
+        pio_write (d, sec_no, n, buffers);
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multi (d, sec_no, 1, &buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multi (d, sec_no, 1, &buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi,
+    NULL
   };
-
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFERS in PIO mode.  The disk interrupts once as each
+   sector becomes ready.  The channel lock must be held. */
+static void
+pio_read (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+          void *const buffers[])
+{
+  struct channel *c = d->channel;
+  size_t i;
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < cnt; i++)
+    {
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no + i);
+      input_sector (c, buffers[i]);
+    }
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   from BUFFERS in PIO mode.  The disk interrupts once as it
+   finishes with each sector.  The channel lock must be held. */
+static void
+pio_write (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+           const void *const buffers[])
+{
+  struct channel *c = d->channel;
+  size_t i;
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+  for (i = 0; i < cnt; i++)
+    {
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no + i);
+      output_sector (c, buffers[i]);
+      sema_down (&c->completion_wait);
+    }
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT to the disk's sector selection
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= 256);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt & 0xff);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -402,7 +577,8 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
+   completion interrupt.  Used for DMA commands too, which differ
+   only in who moves the data. */
 static void
 issue_pio_command (struct channel *c, uint8_t command) 
 {
@@ -430,6 +606,93 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Fills channel C's PRD table to describe the CNT sectors in
+   BUFFERS, merging buffers that are physically adjacent and
+   splitting regions at 64 kB boundaries.  Returns true if
+   successful, false if some buffer cannot be reached by DMA. */
+static bool
+build_prdt (struct channel *c, size_t cnt, void *const buffers[])
+{
+  size_t prd_cnt = 0;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      uintptr_t addr;
+      size_t size = BLOCK_SECTOR_SIZE;
+
+      if (!is_kernel_vaddr (buffers[i]) || ((uintptr_t) buffers[i] & 1) != 0)
+        return false;
+
+      addr = vtop (buffers[i]);
+      while (size > 0)
+        {
+          size_t chunk = 0x10000 - (addr & 0xffff);
+          struct prd *last = prd_cnt > 0 ? &c->prdt[prd_cnt - 1] : NULL;
+
+          if (chunk > size)
+            chunk = size;
+          if (last != NULL && last->addr + last->size == addr
+              && (addr & 0xffff) != 0 && last->size + chunk < 0x10000)
+            last->size += chunk;
+          else
+            {
+              if (prd_cnt >= PRD_CNT)
+                return false;
+              c->prdt[prd_cnt].addr = addr;
+              c->prdt[prd_cnt].size = chunk & 0xffff;
+              c->prdt[prd_cnt].flags = 0;
+              prd_cnt++;
+            }
+          addr += chunk;
+          size -= chunk;
+        }
+    }
+  c->prdt[prd_cnt - 1].flags = PRD_EOT;
+  return true;
+}
+
+/* Transfers CNT consecutive sectors starting at SEC_NO of disk D
+   by bus-master DMA, from disk to BUFFERS if READ is true,
+   otherwise from BUFFERS to disk.  The whole transfer takes one
+   command and one interrupt, and the CPU is free to run other
+   threads meanwhile.  Returns true if successful, false if
+   BUFFERS cannot be used for DMA, in which case the caller
+   should fall back to PIO.  The channel lock must be held. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *const buffers[], bool read)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = read ? BMC_READ : 0;
+  uint8_t bm_status, status;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (cnt >= 1 && cnt <= IDE_MAX_SECTORS);
+
+  if (!build_prdt (c, cnt, buffers))
+    return false;
+
+  /* Program the bus master, then the disk, then start. */
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), BMS_ERROR | BMS_INTR);
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, read ? CMD_READ_DMA : CMD_WRITE_DMA);
+  outb (reg_bm_command (c), direction | BMC_START);
+  sema_down (&c->completion_wait);
+
+  /* Stop the bus master and check for errors. */
+  outb (reg_bm_command (c), direction);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), BMS_ERROR | BMS_INTR);
+  status = inb (reg_alt_status (c));
+  if ((bm_status & BMS_ERROR) || (status & (STA_ERR | STA_DF)))
+    PANIC ("%s: DMA %s failed, sectors %"PRDSNu"+%zu",
+           d->name, read ? "read" : "write", sec_no, cnt);
+  return true;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -1,6 +1,12 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* If true, never use DMA, even if it is available.
+   Controlled by kernel command-line option "-pio". */
+extern bool ide_pio_only;
+
 void ide_init (void);
 
 #endif /* devices/ide.h */
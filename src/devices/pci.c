@@ -0,0 +1,252 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include <round.h>
+#include "threads/init.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+
+/* This code accesses PCI configuration space through
+   configuration mechanism #1, the pair of I/O ports that every
+   PC chipset since the original PCI ones provides.  It is just
+   enough for drivers to find their devices and program them. */
+
+/* Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDR 0xcf8   /* Selects a configuration register. */
+#define PCI_CONFIG_DATA 0xcfc   /* Reads or writes the selected one. */
+
+/* Header type register, and its bit that marks a device with
+   more than one function. */
+#define PCI_REG_HEADER 0x0c
+#define PCI_HEADER_MULTI 0x00800000
+
+/* Kernel virtual addresses at which pci_map_mem() maps device
+   memory: the top 4 MB of the address space, which lies beyond
+   the mapping of physical memory at PHYS_BASE. */
+#define MMIO_BASE ((uint8_t *) 0xffc00000)
+#define MMIO_END ((uint8_t *) 0xfffff000)
+
+/* Most handlers that may share one interrupt line. */
+#define IRQ_HANDLER_CNT 4
+
+/* Number of buses, devices per bus and functions per device. */
+#define PCI_BUS_CNT 256
+#define PCI_DEV_CNT 32
+#define PCI_FUNC_CNT 8
+
+/* Returns the value that selects register REG of function P. */
+static uint32_t
+config_address (const struct pci_dev *p, uint8_t reg)
+{
+  ASSERT ((reg & 3) == 0);
+  return (0x80000000u | ((uint32_t) p->bus << 16) | ((uint32_t) p->dev << 11)
+          | ((uint32_t) p->func << 8) | reg);
+}
+
+/* Returns the 32-bit configuration register REG of function P. */
+uint32_t
+pci_read_config (const struct pci_dev *p, uint8_t reg)
+{
+  outl (PCI_CONFIG_ADDR, config_address (p, reg));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Sets the 32-bit configuration register REG of function P to
+   VALUE. */
+void
+pci_write_config (const struct pci_dev *p, uint8_t reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, config_address (p, reg));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Returns the value of base address register BAR (0...5) of
+   function P.  The low bits of an I/O BAR are flags; callers
+   should mask them off. */
+uint32_t
+pci_get_bar (const struct pci_dev *p, int bar)
+{
+  ASSERT (bar >= 0 && bar < 6);
+  return pci_read_config (p, PCI_REG_BAR0 + bar * 4);
+}
+
+/* Sets COMMAND_BITS, some PCI_CMD_* bits, in function P's
+   command register, leaving the status register alone. */
+void
+pci_enable (const struct pci_dev *p, uint16_t command_bits)
+{
+  uint32_t cmd = pci_read_config (p, PCI_REG_COMMAND) & 0xffff;
+  pci_write_config (p, PCI_REG_COMMAND, cmd | command_bits);
+}
+
+/* Calls MATCH for every function present on the system, in bus,
+   device and function order, until it returns true.  Stores the
+   matching function into *P and returns true, or returns false
+   if none matched. */
+static bool
+scan (bool (*match) (const struct pci_dev *, const void *aux),
+      const void *aux, struct pci_dev *p)
+{
+  struct pci_dev cur;
+  int bus, dev, func;
+
+  for (bus = 0; bus < PCI_BUS_CNT; bus++)
+    for (dev = 0; dev < PCI_DEV_CNT; dev++)
+      for (func = 0; func < PCI_FUNC_CNT; func++)
+        {
+          uint32_t id;
+
+          cur.bus = bus;
+          cur.dev = dev;
+          cur.func = func;
+          id = pci_read_config (&cur, PCI_REG_ID);
+          if ((id & 0xffff) == 0xffff)
+            {
+              /* No function 0 means no device at all. */
+              if (func == 0)
+                break;
+              continue;
+            }
+          if (match (&cur, aux))
+            {
+              *p = cur;
+              return true;
+            }
+
+          /* Only multi-function devices have functions past 0. */
+          if (func == 0
+              && !(pci_read_config (&cur, PCI_REG_HEADER)
+                   & PCI_HEADER_MULTI))
+            break;
+        }
+  return false;
+}
+
+/* Class and subclass to look for. */
+struct class_match
+  {
+    uint8_t class;
+    uint8_t subclass;
+  };
+
+static bool
+match_class (const struct pci_dev *p, const void *aux)
+{
+  const struct class_match *m = aux;
+  uint32_t class = pci_read_config (p, PCI_REG_CLASS);
+  return (class >> 24) == m->class && ((class >> 16) & 0xff) == m->subclass;
+}
+
+/* Finds the first function with the given CLASS and SUBCLASS
+   codes and stores its location in *P.  Returns true if
+   successful, false if there is none. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *p)
+{
+  struct class_match m;
+
+  m.class = class;
+  m.subclass = subclass;
+  return scan (match_class, &m, p);
+}
+
+/* Vendor and device IDs to look for, and how many matches to
+   skip. */
+struct id_match
+  {
+    uint32_t id;
+    int skip;
+  };
+
+static bool
+match_id (const struct pci_dev *p, const void *aux_)
+{
+  struct id_match *m = (struct id_match *) aux_;
+  return pci_read_config (p, PCI_REG_ID) == m->id && m->skip-- == 0;
+}
+
+/* Finds the INDEXth (counting from 0) function with the given
+   VENDOR and DEVICE IDs and stores its location in *P.
+   Returns true if successful, false if there is none. */
+bool
+pci_find_device (uint16_t vendor, uint16_t device, int index,
+                 struct pci_dev *p)
+{
+  struct id_match m;
+
+  m.id = ((uint32_t) device << 16) | vendor;
+  m.skip = index;
+  return scan (match_id, &m, p);
+}
+
+/* Maps the SIZE bytes of device memory at physical address PHYS,
+   typically from a memory BAR, into kernel virtual memory with
+   caching disabled and returns its address.  Panics if the
+   mapping window is full.
+
+   The mapping goes into the initial page directory, from which
+   every process page directory copies the kernel's mappings when
+   it is created, so call this only while the kernel starts up. */
+void *
+pci_map_mem (uint32_t phys, size_t size)
+{
+  static uint8_t *next = MMIO_BASE;
+  static uint32_t *pt;
+  uint32_t page_ofs = phys & PGMASK;
+  size_t page_cnt = DIV_ROUND_UP (page_ofs + size, PGSIZE);
+  uint8_t *start = next;
+  size_t i;
+
+  if (pt == NULL)
+    {
+      pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+      init_page_dir[pd_no (MMIO_BASE)] = pde_create (pt);
+    }
+  if (page_cnt > (size_t) (MMIO_END - next) / PGSIZE)
+    PANIC ("out of address space for device memory");
+
+  phys -= page_ofs;
+  for (i = 0; i < page_cnt; i++)
+    pt[pt_no (next + i * PGSIZE)] = ((phys + i * PGSIZE)
+                                     | PTE_PCD | PTE_W | PTE_P);
+  next += page_cnt * PGSIZE;
+  return start + page_ofs;
+}
+
+/* Handlers registered for each of the 16 interrupt lines. */
+static intr_handler_func *irq_handlers[16][IRQ_HANDLER_CNT];
+
+/* Calls every handler registered for the interrupt line that
+   raised F.  PCI interrupt lines may be shared, so each handler
+   must check whether its own device needs attention. */
+static void
+shared_interrupt (struct intr_frame *f)
+{
+  intr_handler_func **h = irq_handlers[f->vec_no - 0x20];
+  size_t i;
+
+  for (i = 0; i < IRQ_HANDLER_CNT && h[i] != NULL; i++)
+    h[i] (f);
+}
+
+/* Registers HANDLER, named NAME for debugging purposes, for
+   interrupt line IRQ, typically read from a function's
+   PCI_REG_IRQ register.  Unlike intr_register_ext(), allows
+   several devices to share the line. */
+void
+pci_register_irq (uint8_t irq, intr_handler_func *handler, const char *name)
+{
+  intr_handler_func **h;
+  size_t i;
+
+  ASSERT (irq < 16);
+  h = irq_handlers[irq];
+  for (i = 0; i < IRQ_HANDLER_CNT && h[i] != NULL; i++)
+    continue;
+  if (i >= IRQ_HANDLER_CNT)
+    PANIC ("too many handlers for IRQ %d", irq);
+  h[i] = handler;
+  if (i == 0)
+    intr_register_ext (irq + 0x20, shared_interrupt, name);
+}
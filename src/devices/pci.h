@@ -0,0 +1,43 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+
+/* Location of a PCI function in configuration space. */
+struct pci_dev
+  {
+    uint8_t bus;                /* Bus number. */
+    uint8_t dev;                /* Device number, 0...31. */
+    uint8_t func;               /* Function number, 0...7. */
+  };
+
+/* Offsets of standard configuration space registers. */
+#define PCI_REG_ID 0x00         /* Vendor ID (low), device ID (high). */
+#define PCI_REG_COMMAND 0x04    /* Command (low), status (high). */
+#define PCI_REG_CLASS 0x08      /* Revision, prog IF, subclass, class. */
+#define PCI_REG_BAR0 0x10       /* Base address register 0 of 6. */
+#define PCI_REG_IRQ 0x3c        /* Interrupt line (low byte). */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001       /* Respond to I/O space accesses. */
+#define PCI_CMD_MEM 0x0002      /* Respond to memory space accesses. */
+#define PCI_CMD_MASTER 0x0004   /* Allow bus mastering. */
+
+/* Base address register bits. */
+#define PCI_BAR_IO 0x00000001   /* Set for an I/O space BAR. */
+#define PCI_BAR_MEM_MASK 0xfffffff0 /* Address bits of a memory BAR. */
+
+bool pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *);
+bool pci_find_device (uint16_t vendor, uint16_t device, int index,
+                      struct pci_dev *);
+uint32_t pci_read_config (const struct pci_dev *, uint8_t reg);
+void pci_write_config (const struct pci_dev *, uint8_t reg, uint32_t);
+uint32_t pci_get_bar (const struct pci_dev *, int bar);
+void pci_enable (const struct pci_dev *, uint16_t command_bits);
+void *pci_map_mem (uint32_t phys, size_t size);
+void pci_register_irq (uint8_t irq, intr_handler_func *, const char *name);
+
+#endif /* devices/pci.h */
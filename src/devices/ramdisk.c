@@ -0,0 +1,114 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A RAM disk keeps its sectors in kernel pages, which need not
+   be contiguous, so that a large disk does not depend on finding
+   a large run of free pages.  Its contents vanish at shutdown. */
+
+/* Number of sectors in a page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    uint8_t **pages;            /* Pages that hold the sectors. */
+    struct lock lock;           /* Serializes transfers. */
+  };
+
+size_t ramdisk_filesys_kb;
+size_t ramdisk_scratch_kb;
+
+static struct block_operations ramdisk_operations;
+
+static void create_ramdisk (enum block_type, size_t kb);
+
+/* Creates the RAM disks requested on the kernel command line.
+   Call this before detecting other block devices, so that the
+   RAM disks come first in probe order and are therefore picked
+   for their roles by default. */
+void
+ramdisk_init (void)
+{
+  if (ramdisk_filesys_kb > 0)
+    create_ramdisk (BLOCK_FILESYS, ramdisk_filesys_kb);
+  if (ramdisk_scratch_kb > 0)
+    create_ramdisk (BLOCK_SCRATCH, ramdisk_scratch_kb);
+}
+
+/* Creates and registers a zero-filled RAM disk of the given TYPE
+   with room for KB kB, rounded up to a whole page. */
+static void
+create_ramdisk (enum block_type type, size_t kb)
+{
+  static int disk_cnt;
+  struct ramdisk *rd;
+  size_t page_cnt = DIV_ROUND_UP (kb * 1024, PGSIZE);
+  size_t i;
+  char name[16];
+
+  rd = malloc (sizeof *rd);
+  if (rd != NULL)
+    rd->pages = malloc (page_cnt * sizeof *rd->pages);
+  if (rd == NULL || rd->pages == NULL)
+    PANIC ("Failed to allocate memory for RAM disk descriptor");
+  for (i = 0; i < page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        PANIC ("Out of memory creating %zu kB RAM disk", kb);
+    }
+  lock_init (&rd->lock);
+
+  snprintf (name, sizeof name, "rd%d", disk_cnt++);
+  block_register (name, type, "RAM disk", page_cnt * SECTORS_PER_PAGE,
+                  &ramdisk_operations, rd);
+}
+
+/* Returns the address of SECTOR in RD. */
+static uint8_t *
+sector_addr (struct ramdisk *rd, block_sector_t sector)
+{
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads sector SECTOR from RAM disk RD into BUFFER, which must
+   have room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_read (void *rd_, block_sector_t sector, void *buffer)
+{
+  struct ramdisk *rd = rd_;
+
+  lock_acquire (&rd->lock);
+  memcpy (buffer, sector_addr (rd, sector), BLOCK_SECTOR_SIZE);
+  lock_release (&rd->lock);
+}
+
+/* Writes sector SECTOR to RAM disk RD from BUFFER, which must
+   contain BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write (void *rd_, block_sector_t sector, const void *buffer)
+{
+  struct ramdisk *rd = rd_;
+
+  lock_acquire (&rd->lock);
+  memcpy (sector_addr (rd, sector), buffer, BLOCK_SECTOR_SIZE);
+  lock_release (&rd->lock);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL,
+    NULL
+  };
@@ -0,0 +1,15 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+#include <stddef.h>
+
+/* Sizes in kB of the RAM disks to create for the file system
+   and scratch roles, or 0 for none.
+   Controlled by kernel command-line options "-rdfs=KB" and
+   "-rdscratch=KB". */
+extern size_t ramdisk_filesys_kb;
+extern size_t ramdisk_scratch_kb;
+
+void ramdisk_init (void);
+
+#endif /* devices/ramdisk.h */
@@ -11,7 +11,13 @@
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
+#endif
+#ifdef VM
+#include "vm/swap.h"
 #endif
 
 /* Keyboard control register port. */
@@ -132,6 +138,12 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  cache_print_stats ();
+  dcache_print_stats ();
+  journal_print_stats ();
+#endif
+#ifdef VM
+  swap_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
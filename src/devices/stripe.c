@@ -0,0 +1,202 @@
+#include "devices/stripe.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+
+/* A striped (RAID-0) array lays its sectors out across its member
+   devices in stripe units of STRIPE_SECTORS sectors each: unit 0
+   on the first member, unit 1 on the second, and so on, wrapping
+   around to the first member after the last.  A long sequential
+   transfer thus keeps every member busy at once.  There is no
+   redundancy: losing any member loses the array. */
+
+/* Most members in an array. */
+#define MEMBER_MAX 8
+
+/* Most member requests in flight at once for a single transfer. */
+#define BATCH_MAX 8
+
+/* A striped array. */
+struct stripe
+  {
+    struct block *members[MEMBER_MAX];  /* Member devices. */
+    size_t member_cnt;                  /* Number of members. */
+    block_sector_t unit;                /* Sectors per stripe unit. */
+  };
+
+char *stripe_members;
+size_t stripe_sectors = 8;
+
+static struct block_operations stripe_operations;
+
+/* Creates the striped array requested on the kernel command line,
+   if any, and registers it as a file system device named
+   STRIPE_NAME.  Call this after detecting the devices that are to
+   be its members. */
+void
+stripe_init (void)
+{
+  struct stripe *s;
+  block_sector_t member_size;
+  char *name, *save_ptr;
+  char extra_info[128];
+  size_t i;
+
+  if (stripe_members == NULL)
+    return;
+  if (stripe_sectors == 0)
+    PANIC ("Stripe size must be at least one sector");
+
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    PANIC ("Failed to allocate memory for stripe descriptor");
+  s->member_cnt = 0;
+  s->unit = stripe_sectors;
+
+  member_size = 0;
+  for (name = strtok_r (stripe_members, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      struct block *block = block_get_by_name (name);
+      enum block_type type;
+
+      if (block == NULL)
+        PANIC ("No such block device \"%s\"", name);
+      type = block_type (block);
+      if (type != BLOCK_RAW && type != BLOCK_FOREIGN)
+        PANIC ("%s: Cannot stripe %s device", name, block_type_name (type));
+      if (s->member_cnt >= MEMBER_MAX)
+        PANIC ("Too many stripe members (maximum %d)", MEMBER_MAX);
+      if (!block_claim (block))
+        PANIC ("%s: Device already in use", name);
+
+      s->members[s->member_cnt++] = block;
+      if (member_size == 0 || block_size (block) < member_size)
+        member_size = block_size (block);
+    }
+  if (s->member_cnt < 2)
+    PANIC ("Striping needs at least two devices");
+
+  /* Every member contributes as many whole units as the smallest
+     member can hold. */
+  member_size -= member_size % s->unit;
+  if (member_size == 0)
+    PANIC ("Stripe size exceeds smallest member");
+
+  snprintf (extra_info, sizeof extra_info,
+            "%zu-way stripe of %"PRDSNu"-sector units",
+            s->member_cnt, s->unit);
+  for (i = 0; i < s->member_cnt; i++)
+    {
+      size_t len = strlen (extra_info);
+      snprintf (extra_info + len, sizeof extra_info - len, "%s%s",
+                i == 0 ? " over " : ",", block_name (s->members[i]));
+    }
+  block_register (STRIPE_NAME, BLOCK_FILESYS, extra_info,
+                  member_size * s->member_cnt, &stripe_operations, s);
+}
+
+/* Returns the member of S that holds SECTOR and translates SECTOR
+   into a sector on that member.  Stores in *RUN the number of
+   sectors from SECTOR to the end of its stripe unit. */
+static struct block *
+map_sector (struct stripe *s, block_sector_t *sector, size_t *run)
+{
+  block_sector_t unit_nr = *sector / s->unit;
+  block_sector_t unit_ofs = *sector % s->unit;
+
+  *sector = unit_nr / s->member_cnt * s->unit + unit_ofs;
+  *run = s->unit - unit_ofs;
+  return s->members[unit_nr % s->member_cnt];
+}
+
+/* Transfers CNT sectors starting at SECTOR of S to or from
+   BUFFERS, one member request per stripe unit touched.  Requests
+   are submitted in batches and then waited for, so that members
+   on different channels work in parallel. */
+static void
+stripe_transfer (struct stripe *s, block_sector_t sector, size_t cnt,
+                 bool write, void *const buffers[])
+{
+  while (cnt > 0)
+    {
+      struct block_request requests[BATCH_MAX];
+      size_t request_cnt = 0;
+      size_t i;
+
+      while (cnt > 0 && request_cnt < BATCH_MAX)
+        {
+          struct block_request *r = &requests[request_cnt++];
+          struct block *member;
+          size_t run;
+
+          r->sector = sector;
+          member = map_sector (s, &r->sector, &run);
+          r->cnt = cnt < run ? cnt : run;
+          r->write = write;
+          r->buffers = buffers;
+          r->complete = NULL;
+          block_submit (member, r);
+
+          sector += r->cnt;
+          buffers += r->cnt;
+          cnt -= r->cnt;
+        }
+      for (i = 0; i < request_cnt; i++)
+        block_wait (&requests[i]);
+    }
+}
+
+/* Reads sector SECTOR from striped array S_ into BUFFER. */
+static void
+stripe_read (void *s_, block_sector_t sector, void *buffer)
+{
+  struct stripe *s = s_;
+  size_t run;
+  struct block *member = map_sector (s, &sector, &run);
+
+  block_read (member, sector, buffer);
+}
+
+/* Writes sector SECTOR to striped array S_ from BUFFER. */
+static void
+stripe_write (void *s_, block_sector_t sector, const void *buffer)
+{
+  struct stripe *s = s_;
+  size_t run;
+  struct block *member = map_sector (s, &sector, &run);
+
+  block_write (member, sector, buffer);
+}
+
+/* Reads CNT sectors starting at SECTOR from striped array S_ into
+   BUFFERS. */
+static void
+stripe_read_multi (void *s_, block_sector_t sector, size_t cnt,
+                   void *const buffers[])
+{
+  stripe_transfer (s_, sector, cnt, false, buffers);
+}
+
+/* Writes CNT sectors starting at SECTOR to striped array S_ from
+   BUFFERS. */
+static void
+stripe_write_multi (void *s_, block_sector_t sector, size_t cnt,
+                    const void *const buffers[])
+{
+  stripe_transfer (s_, sector, cnt, true, (void *const *) buffers);
+}
+
+/* A striped array has no lower operation, because its sectors do
+   not map onto a single device below; member requests are queued
+   on the members instead. */
+static struct block_operations stripe_operations =
+  {
+    stripe_read,
+    stripe_write,
+    stripe_read_multi,
+    stripe_write_multi,
+    NULL
+  };
@@ -0,0 +1,20 @@
+#ifndef DEVICES_STRIPE_H
+#define DEVICES_STRIPE_H
+
+#include <stddef.h>
+
+/* Name under which the striped array is registered. */
+#define STRIPE_NAME "md0"
+
+/* Comma-separated names of the block devices to stripe together
+   into a file system device, or a null pointer for none.
+   Controlled by kernel command-line option "-stripe=BDEV,...". */
+extern char *stripe_members;
+
+/* Sectors in each stripe unit.
+   Controlled by kernel command-line option "-stripe-size=SECTORS". */
+extern size_t stripe_sectors;
+
+void stripe_init (void);
+
+#endif /* devices/stripe.h */
@@ -0,0 +1,473 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* This driver speaks the "legacy" virtio PCI interface that
+   QEMU offers for virtio-blk devices.  Each disk has a single
+   split virtqueue: a table of descriptors, an "available" ring
+   through which we hand chains of descriptors to the device, and
+   a "used" ring through which the device hands them back.  A
+   request is a chain of a header, one descriptor per run of
+   physically contiguous data, and a status byte.
+
+   Requests are not queued in the block layer.  Any number of
+   threads may each have a request in flight at once, up to the
+   size of the virtqueue, and the device is free to complete them
+   in any order. */
+
+/* Legacy virtio PCI vendor and device ID for a block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* Legacy virtio register offsets from BAR 0. */
+#define reg_host_features(DISK) ((DISK)->io_base + 0x00)
+#define reg_guest_features(DISK) ((DISK)->io_base + 0x04)
+#define reg_queue_pfn(DISK) ((DISK)->io_base + 0x08)
+#define reg_queue_size(DISK) ((DISK)->io_base + 0x0c)
+#define reg_queue_select(DISK) ((DISK)->io_base + 0x0e)
+#define reg_queue_notify(DISK) ((DISK)->io_base + 0x10)
+#define reg_status(DISK) ((DISK)->io_base + 0x12)
+#define reg_isr(DISK) ((DISK)->io_base + 0x13)
+
+/* virtio-blk configuration: capacity in sectors, low and high
+   halves. */
+#define reg_capacity_lo(DISK) ((DISK)->io_base + 0x14)
+#define reg_capacity_hi(DISK) ((DISK)->io_base + 0x18)
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* We have noticed the device. */
+#define STATUS_DRIVER 0x02      /* We know how to drive it. */
+#define STATUS_DRIVER_OK 0x04   /* We are ready to drive it. */
+
+/* ISR status bit for a used ring update. */
+#define ISR_QUEUE 0x01
+
+/* Descriptor flags. */
+#define DESC_NEXT 0x0001        /* NEXT field is valid. */
+#define DESC_WRITE 0x0002       /* Device writes, as opposed to reads. */
+
+/* A descriptor for a region of memory. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address. */
+    uint32_t len;               /* Length in bytes. */
+    uint16_t flags;             /* DESC_* flags. */
+    uint16_t next;              /* Next descriptor in chain. */
+  };
+
+/* The ring of chains that we make available to the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where we put the next entry. */
+    uint16_t ring[];            /* Heads of descriptor chains. */
+  };
+
+/* An entry in the used ring. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of a descriptor chain. */
+    uint32_t len;               /* Bytes written by the device. */
+  };
+
+/* The ring of chains that the device has finished with. */
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the device puts the next entry. */
+    struct vring_used_elem ring[];
+  };
+
+/* Request header. */
+struct virtio_blk_hdr
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector. */
+  };
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+
+/* Status byte value for success. */
+#define VIRTIO_BLK_S_OK 0
+
+/* Most sectors moved by a single request.  A request uses one
+   descriptor for each sector at most, plus two. */
+#define VIRTIO_MAX_SECTORS 32
+
+/* A request in flight.  Lives on the stack of the thread that
+   issued it, which the device can reach like any other kernel
+   memory. */
+struct virtio_request
+  {
+    struct virtio_blk_hdr hdr;  /* Read by the device. */
+    uint8_t status;             /* Written by the device. */
+    struct semaphore done;      /* Up'd by interrupt handler. */
+  };
+
+/* A virtio-blk disk. */
+struct virtio_disk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Base I/O port of legacy registers. */
+    uint8_t irq;                /* Interrupt vector. */
+
+    uint16_t queue_size;        /* Number of descriptors. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    struct vring_used *used;    /* Used ring. */
+    struct virtio_request **requests; /* Request for each chain head. */
+
+    struct lock lock;           /* Protects the members below. */
+    struct condition desc_freed; /* Signaled when descriptors free up. */
+    uint16_t free_head;         /* First free descriptor. */
+    uint16_t free_cnt;          /* Number of free descriptors. */
+
+    uint16_t used_idx;          /* Next used entry to process.  Only the
+                                   interrupt handler touches it. */
+  };
+
+/* We support up to four disks, "vda" through "vdd". */
+#define DISK_CNT 4
+static struct virtio_disk disks[DISK_CNT];
+static size_t disk_cnt;
+
+static struct block_operations virtio_operations;
+
+static bool init_disk (struct virtio_disk *, const struct pci_dev *);
+static bool init_queue (struct virtio_disk *);
+static void register_disk (struct virtio_disk *);
+static void transfer (struct virtio_disk *, block_sector_t, size_t cnt,
+                      void *const buffers[], bool read);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds, initializes and registers the virtio-blk disks. */
+void
+virtio_blk_init (void)
+{
+  struct pci_dev p;
+  int index;
+
+  for (index = 0; disk_cnt < DISK_CNT
+                  && pci_find_device (VIRTIO_VENDOR, VIRTIO_BLK_DEVICE,
+                                      index, &p); index++)
+    {
+      struct virtio_disk *d = &disks[disk_cnt];
+
+      snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+      if (init_disk (d, &p))
+        {
+          /* The interrupt handler only looks at the first
+             DISK_CNT disks, so count this one before reading its
+             partition table. */
+          disk_cnt++;
+          register_disk (d);
+        }
+    }
+}
+
+/* Brings up the virtio-blk device in PCI function P as disk D.
+   Returns true if successful, false if the device is unusable. */
+static bool
+init_disk (struct virtio_disk *d, const struct pci_dev *p)
+{
+  uint32_t bar = pci_get_bar (p, 0);
+  uint8_t irq = pci_read_config (p, PCI_REG_IRQ) & 0xff;
+  size_t i;
+
+  if (!(bar & PCI_BAR_IO) || irq >= 16)
+    {
+      printf ("%s: unusable PCI configuration, ignoring\n", d->name);
+      return false;
+    }
+  d->io_base = bar & ~3u;
+  d->irq = irq + 0x20;
+  pci_enable (p, PCI_CMD_IO | PCI_CMD_MASTER);
+
+  /* Reset the device and tell it that we can drive it.  We need
+     none of its optional features. */
+  outb (reg_status (d), 0);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  outl (reg_guest_features (d), 0);
+  if (!init_queue (d))
+    {
+      printf ("%s: cannot set up virtqueue, ignoring\n", d->name);
+      outb (reg_status (d), 0);
+      return false;
+    }
+  lock_init (&d->lock);
+  cond_init (&d->desc_freed);
+  d->used_idx = 0;
+
+  /* The handler serves every disk on its interrupt line, so
+     register it only for the first disk on each. */
+  for (i = 0; i < disk_cnt; i++)
+    if (disks[i].irq == d->irq)
+      break;
+  if (i == disk_cnt)
+    pci_register_irq (irq, interrupt_handler, "virtio-blk");
+
+  outb (reg_status (d),
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+  return true;
+}
+
+/* Allocates disk D's virtqueue and tells the device where it is.
+   Returns true if successful, false on failure. */
+static bool
+init_queue (struct virtio_disk *d)
+{
+  size_t desc_size, avail_size, used_ofs, used_size;
+  uint8_t *base;
+  uint16_t i;
+
+  outw (reg_queue_select (d), 0);
+  d->queue_size = inw (reg_queue_size (d));
+  if (d->queue_size < VIRTIO_MAX_SECTORS + 2)
+    return false;
+
+  /* The legacy layout puts the used ring on the first page
+     boundary after the descriptor table and available ring, and
+     requires the whole queue to be physically contiguous. */
+  desc_size = d->queue_size * sizeof *d->desc;
+  avail_size = sizeof *d->avail + (d->queue_size + 1) * sizeof (uint16_t);
+  used_ofs = ROUND_UP (desc_size + avail_size, PGSIZE);
+  used_size = (sizeof *d->used + sizeof (uint16_t)
+               + d->queue_size * sizeof (struct vring_used_elem));
+  base = palloc_get_multiple (PAL_ZERO,
+                              DIV_ROUND_UP (used_ofs + used_size, PGSIZE));
+  d->requests = malloc (d->queue_size * sizeof *d->requests);
+  if (base == NULL || d->requests == NULL)
+    return false;
+  d->desc = (struct vring_desc *) base;
+  d->avail = (struct vring_avail *) (base + desc_size);
+  d->used = (struct vring_used *) (base + used_ofs);
+
+  for (i = 0; i < d->queue_size; i++)
+    d->desc[i].next = i + 1;
+  d->free_head = 0;
+  d->free_cnt = d->queue_size;
+
+  outl (reg_queue_pfn (d), vtop (base) >> PGBITS);
+  return true;
+}
+
+/* Registers disk D with the block layer and scans it for
+   partitions. */
+static void
+register_disk (struct virtio_disk *d)
+{
+  uint64_t capacity = (inl (reg_capacity_lo (d))
+                       | (uint64_t) inl (reg_capacity_hi (d)) << 32);
+  struct block *block;
+
+  if (capacity > (block_sector_t) -1)
+    {
+      printf ("%s: ignoring disk too large to address\n", d->name);
+      return;
+    }
+
+  /* Requests are not queued: the device takes many at once and
+     has no seeks for an elevator to save. */
+  block = block_register (d->name, BLOCK_RAW, "virtio-blk", capacity,
+                          &virtio_operations, d);
+  partition_scan (block);
+}
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFERS.  Runs of up to VIRTIO_MAX_SECTORS sectors are
+   moved by a single request.  Internally synchronizes accesses
+   to disks, so external per-disk locking is unneeded. */
+static void
+virtio_read_multi (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *const buffers[])
+{
+  struct virtio_disk *d = d_;
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < VIRTIO_MAX_SECTORS ? cnt : VIRTIO_MAX_SECTORS;
+      transfer (d, sec_no, n, buffers, true);
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   from BUFFERS.  Returns after the disk has acknowledged
+   receiving the data.  Internally synchronizes accesses to
+   disks, so external per-disk locking is unneeded. */
+static void
+virtio_write_multi (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *const buffers[])
+{
+  struct virtio_disk *d = d_;
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < VIRTIO_MAX_SECTORS ? cnt : VIRTIO_MAX_SECTORS;
+      transfer (d, sec_no, n, (void *const *) buffers, false);
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  virtio_read_multi (d, sec_no, 1, &buffer);
+}
+
+/* Writes sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  virtio_write_multi (d, sec_no, 1, &buffer);
+}
+
+static struct block_operations virtio_operations =
+  {
+    virtio_read,
+    virtio_write,
+    virtio_read_multi,
+    virtio_write_multi,
+    NULL
+  };
+
+/* Sets descriptor IDX in disk D to describe LEN bytes at
+   physical address ADDR, with the given FLAGS. */
+static void
+set_desc (struct virtio_disk *d, uint16_t idx, uintptr_t addr, uint32_t len,
+          uint16_t flags)
+{
+  d->desc[idx].addr = addr;
+  d->desc[idx].len = len;
+  d->desc[idx].flags = flags;
+}
+
+/* Moves the CNT sectors starting at SEC_NO between disk D and
+   BUFFERS, reading if READ is true and writing otherwise, and
+   waits for the device to finish.  Buffers that are physically
+   adjacent share a descriptor. */
+static void
+transfer (struct virtio_disk *d, block_sector_t sec_no, size_t cnt,
+          void *const buffers[], bool read)
+{
+  struct virtio_request r;
+  uintptr_t seg_addr[VIRTIO_MAX_SECTORS];
+  uint32_t seg_len[VIRTIO_MAX_SECTORS];
+  uint16_t chain[VIRTIO_MAX_SECTORS + 2];
+  size_t seg_cnt = 0;
+  size_t chain_cnt;
+  size_t i;
+
+  ASSERT (cnt >= 1 && cnt <= VIRTIO_MAX_SECTORS);
+
+  for (i = 0; i < cnt; i++)
+    {
+      uintptr_t addr = vtop (buffers[i]);
+      if (seg_cnt > 0 && seg_addr[seg_cnt - 1] + seg_len[seg_cnt - 1] == addr)
+        seg_len[seg_cnt - 1] += BLOCK_SECTOR_SIZE;
+      else
+        {
+          seg_addr[seg_cnt] = addr;
+          seg_len[seg_cnt] = BLOCK_SECTOR_SIZE;
+          seg_cnt++;
+        }
+    }
+  chain_cnt = seg_cnt + 2;
+
+  r.hdr.type = read ? VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT;
+  r.hdr.reserved = 0;
+  r.hdr.sector = sec_no;
+  r.status = 0xff;
+  sema_init (&r.done, 0);
+
+  lock_acquire (&d->lock);
+  while (d->free_cnt < chain_cnt)
+    cond_wait (&d->desc_freed, &d->lock);
+  for (i = 0; i < chain_cnt; i++)
+    {
+      chain[i] = d->free_head;
+      d->free_head = d->desc[chain[i]].next;
+    }
+  d->free_cnt -= chain_cnt;
+
+  /* Build the chain: header, data, status. */
+  set_desc (d, chain[0], vtop (&r.hdr), sizeof r.hdr, DESC_NEXT);
+  for (i = 0; i < seg_cnt; i++)
+    set_desc (d, chain[i + 1], seg_addr[i], seg_len[i],
+              DESC_NEXT | (read ? DESC_WRITE : 0));
+  set_desc (d, chain[chain_cnt - 1], vtop (&r.status), 1, DESC_WRITE);
+  for (i = 0; i + 1 < chain_cnt; i++)
+    d->desc[chain[i]].next = chain[i + 1];
+
+  /* Make the chain available, then tell the device.  The device
+     must see the ring entry before the new index. */
+  d->requests[chain[0]] = &r;
+  d->avail->ring[d->avail->idx % d->queue_size] = chain[0];
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (reg_queue_notify (d), 0);
+  lock_release (&d->lock);
+
+  sema_down (&r.done);
+
+  /* Free the chain. */
+  lock_acquire (&d->lock);
+  d->desc[chain[chain_cnt - 1]].next = d->free_head;
+  d->free_head = chain[0];
+  d->free_cnt += chain_cnt;
+  cond_broadcast (&d->desc_freed, &d->lock);
+  lock_release (&d->lock);
+
+  if (r.status != VIRTIO_BLK_S_OK)
+    PANIC ("%s: %s failed, sectors %"PRDSNu"+%zu",
+           d->name, read ? "read" : "write", sec_no, cnt);
+}
+
+/* virtio-blk interrupt handler.  Wakes up the thread waiting for
+   each request that the device has finished. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    {
+      struct virtio_disk *d = &disks[i];
+
+      if (d->irq != f->vec_no)
+        continue;
+
+      /* Reading the ISR acknowledges the interrupt. */
+      inb (reg_isr (d));
+      while (d->used_idx != *(volatile uint16_t *) &d->used->idx)
+        {
+          struct vring_used_elem *e
+            = &d->used->ring[d->used_idx % d->queue_size];
+          struct virtio_request *r = d->requests[e->id];
+
+          d->requests[e->id] = NULL;
+          sema_up (&r->done);
+          d->used_idx++;
+        }
+    }
+}
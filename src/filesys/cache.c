@@ -0,0 +1,723 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Number of sectors held in the buffer cache. */
+#define CACHE_SIZE 64
+
+/* Most sectors moved between the cache and the disk by one
+   request. */
+#define CACHE_RUN_MAX 16
+
+/* Most runs that cache_flush() has in flight at once. */
+#define FLUSH_DEPTH 4
+
+/* Most entries that cache_flush() pins at once, so that some
+   entries are always left for eviction. */
+#define FLUSH_PIN_MAX (CACHE_SIZE / 2)
+
+/* Marks a cache entry that holds no sector. */
+#define CACHE_FREE ((block_sector_t) -1)
+
+/* A cached copy of one file system sector. */
+struct cache_entry
+  {
+    block_sector_t sector;      /* Sector held, or CACHE_FREE. */
+    block_sector_t old_sector;  /* Sector being written back, or
+                                   CACHE_FREE. */
+    bool dirty;                 /* Modified since last written back? */
+    bool accessed;              /* Used since the clock hand passed? */
+    bool prefetched;            /* Read ahead but not yet used? */
+    bool journaled;             /* Changed by the running journal
+                                   transaction, so not to be written
+                                   back until it commits? */
+    int pin_cnt;                /* Threads using or waiting for entry. */
+    struct lock lock;           /* Held while loading or accessing data. */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes of data. */
+  };
+
+/* A run of consecutive sectors being written back. */
+struct flush_run
+  {
+    struct block_request request;
+    struct cache_entry *entries[CACHE_RUN_MAX];
+    void *buffers[CACHE_RUN_MAX];
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static size_t clock_hand;
+
+/* Protects the sector, old_sector, accessed and pin_cnt members
+   of every entry, as well as clock_hand. */
+static struct lock cache_lock;
+static struct condition cache_unpinned;  /* Some entry was unpinned. */
+static struct condition cache_written;   /* Some write-back finished. */
+
+/* Number of sectors to read ahead of a sequential reader.
+   Controlled by kernel command-line option "-ra=SECTORS". */
+size_t cache_readahead_window = 8;
+
+/* Number of timer ticks between write-behind flushes.
+   Controlled by kernel command-line option "-wb=TICKS". */
+int64_t cache_flush_interval = TIMER_FREQ;
+
+/* Sectors waiting to be fetched by the read-ahead thread.
+   Requests that arrive while the queue is full are dropped. */
+#define READAHEAD_QUEUE_SIZE 64
+static block_sector_t readahead_queue[READAHEAD_QUEUE_SIZE];
+static size_t readahead_head;           /* Next request to fetch. */
+static size_t readahead_cnt;            /* Number of queued requests. */
+static struct lock readahead_lock;      /* Protects the queue. */
+static struct condition readahead_ready;        /* Queue not empty. */
+
+/* Statistics, protected by cache_lock. */
+static long long hit_cnt;               /* Lookups that found the sector. */
+static long long miss_cnt;              /* Lookups that went to disk. */
+static long long prefetch_cnt;          /* Sectors read ahead. */
+static long long prefetch_hit_cnt;      /* Read-ahead sectors later used. */
+
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_claim (block_sector_t, bool wait,
+                                        bool *hit);
+static struct cache_entry *cache_get (block_sector_t, bool load);
+static void cache_put (struct cache_entry *, bool dirty);
+static void cache_unpin (struct cache_entry *);
+static void cache_load_run (block_sector_t, size_t cnt, bool prefetch);
+static size_t insert_sorted (block_sector_t[], struct cache_entry *[],
+                             size_t cnt, struct cache_entry *);
+static void write_back (const block_sector_t[], struct cache_entry *[],
+                        size_t cnt);
+static thread_func readahead_daemon NO_RETURN;
+static thread_func flush_daemon NO_RETURN;
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  uint8_t *data;
+  size_t i;
+
+  data = palloc_get_multiple (PAL_ASSERT,
+                              CACHE_SIZE * BLOCK_SECTOR_SIZE / PGSIZE);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->sector = CACHE_FREE;
+      e->old_sector = CACHE_FREE;
+      e->dirty = false;
+      e->accessed = false;
+      e->prefetched = false;
+      e->journaled = false;
+      e->pin_cnt = 0;
+      lock_init (&e->lock);
+      e->data = data + i * BLOCK_SECTOR_SIZE;
+    }
+  clock_hand = 0;
+  lock_init (&cache_lock);
+  cond_init (&cache_unpinned);
+  cond_init (&cache_written);
+
+  readahead_head = readahead_cnt = 0;
+  lock_init (&readahead_lock);
+  cond_init (&readahead_ready);
+  thread_create ("readahead", PRI_DEFAULT, readahead_daemon, NULL);
+  thread_create ("flusher", PRI_DEFAULT, flush_daemon, NULL);
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Reads SIZE bytes starting at byte OFFSET within sector SECTOR
+   into BUFFER.  BUFFER must be in kernel memory, because the
+   entry is locked during the copy, and a page fault on a user
+   buffer could need the cache itself. */
+void
+cache_read_at (block_sector_t sector, void *buffer, off_t size,
+               off_t offset)
+{
+  struct cache_entry *e;
+
+  ASSERT (offset >= 0 && size >= 0);
+  ASSERT (offset + size <= BLOCK_SECTOR_SIZE);
+
+  ASSERT (is_kernel_vaddr (buffer));
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + offset, size);
+  cache_put (e, false);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to sector SECTOR.
+   The data reaches the disk no later than the next
+   cache_flush(). */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Writes SIZE bytes from BUFFER starting at byte OFFSET within
+   sector SECTOR.  The rest of the sector is read from disk
+   first unless the write covers the whole sector.  BUFFER must
+   be in kernel memory, as for cache_read_at(). */
+void
+cache_write_at (block_sector_t sector, const void *buffer, off_t size,
+                off_t offset)
+{
+  struct cache_entry *e;
+
+  ASSERT (offset >= 0 && size >= 0);
+  ASSERT (offset + size <= BLOCK_SECTOR_SIZE);
+
+  ASSERT (is_kernel_vaddr (buffer));
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + offset, buffer, size);
+  cache_put (e, true);
+}
+
+/* Like cache_write_at(), but for a sector of file system
+   metadata changed by the running journal transaction.  The
+   sector stays in the cache, and out of write-back, until
+   cache_commit() releases it. */
+void
+cache_write_journaled_at (block_sector_t sector, const void *buffer,
+                          off_t size, off_t offset)
+{
+  struct cache_entry *e;
+
+  ASSERT (offset >= 0 && size >= 0);
+  ASSERT (offset + size <= BLOCK_SECTOR_SIZE);
+
+  ASSERT (is_kernel_vaddr (buffer));
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + offset, buffer, size);
+  e->journaled = true;
+  cache_put (e, true);
+}
+
+/* Marks SECTOR, which cache_write_journaled_at() wrote, as
+   committed, so that it is written back like any other dirty
+   sector. */
+void
+cache_commit (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (sector);
+  ASSERT (e != NULL && e->journaled);
+  e->journaled = false;
+  cond_broadcast (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Brings the CNT sectors starting at SECTOR into the cache,
+   reading each run of consecutive uncached sectors from disk
+   with a single request. */
+void
+cache_load (block_sector_t sector, size_t cnt)
+{
+  cache_load_run (sector, cnt, false);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache in
+   the background.  Does nothing if the read-ahead queue is
+   full. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt < READAHEAD_QUEUE_SIZE)
+    {
+      size_t tail = (readahead_head + readahead_cnt) % READAHEAD_QUEUE_SIZE;
+      readahead_queue[tail] = sector;
+      readahead_cnt++;
+      cond_signal (&readahead_ready, &readahead_lock);
+    }
+  lock_release (&readahead_lock);
+}
+
+/* Writes every dirty sector in the cache back to disk, in
+   ascending sector order so that the disk sweeps across the
+   device once.  Runs of consecutive dirty sectors are written
+   with a single request.  Sectors changed by the running journal
+   transaction are skipped.  Returns once every sector written
+   back before the call, including by eviction, is on disk. */
+void
+cache_flush (void)
+{
+  block_sector_t sectors[CACHE_SIZE];
+  struct cache_entry *entries[CACHE_SIZE];
+  size_t cnt = 0;
+  size_t i;
+
+  /* Collect the dirty entries, sorted by sector. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      if (e->sector != CACHE_FREE && e->dirty && !e->journaled)
+        cnt = insert_sorted (sectors, entries, cnt, e);
+    }
+  lock_release (&cache_lock);
+
+  write_back (sectors, entries, cnt);
+}
+
+/* Like cache_flush(), but writes back only those of the
+   TARGET_CNT sectors in TARGETS that are dirty.  Returns once
+   each of them is on disk. */
+void
+cache_sync (const block_sector_t *targets, size_t target_cnt)
+{
+  block_sector_t sectors[CACHE_SIZE];
+  struct cache_entry *entries[CACHE_SIZE];
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < target_cnt; i++)
+    {
+      struct cache_entry *e = cache_lookup (targets[i]);
+      size_t j;
+
+      if (e == NULL || !e->dirty || e->journaled)
+        continue;
+      for (j = 0; j < cnt && entries[j] != e; j++)
+        continue;
+      if (j == cnt)
+        cnt = insert_sorted (sectors, entries, cnt, e);
+    }
+  lock_release (&cache_lock);
+
+  write_back (sectors, entries, cnt);
+}
+
+/* Shuts down the buffer cache, writing back all dirty
+   sectors. */
+void
+cache_done (void)
+{
+  cache_flush ();
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %lld hits, %lld misses, "
+          "%lld sectors read ahead (%lld used), window %zu sectors\n",
+          hit_cnt, miss_cnt, prefetch_cnt, prefetch_hit_cnt,
+          cache_readahead_window);
+}
+
+/* Brings the CNT sectors starting at SECTOR into the cache,
+   reading each run of consecutive uncached sectors with a single
+   request.  If PREFETCH is true, the sectors are counted as read
+   ahead. */
+static void
+cache_load_run (block_sector_t sector, size_t cnt, bool prefetch)
+{
+  while (cnt > 0)
+    {
+      struct cache_entry *run[CACHE_RUN_MAX];
+      void *buffers[CACHE_RUN_MAX];
+      bool cached = false;
+      size_t n, i;
+
+      /* Claim entries for a run of uncached sectors, in
+         ascending order.  Only the first claim may wait for an
+         entry to become free, because waiting while holding
+         entries could deadlock. */
+      for (n = 0; n < cnt && n < CACHE_RUN_MAX; n++)
+        {
+          struct cache_entry *e;
+
+          lock_acquire (&cache_lock);
+          cached = cache_lookup (sector + n) != NULL;
+          lock_release (&cache_lock);
+          if (cached)
+            break;
+
+          e = cache_claim (sector + n, n == 0, &cached);
+          if (e == NULL)
+            break;
+          if (cached)
+            {
+              cache_put (e, false);
+              break;
+            }
+          run[n] = e;
+          buffers[n] = e->data;
+        }
+
+      /* Read the run, then skip it and the cached sector that
+         ended it, if any. */
+      block_read_multi (fs_device, sector, n, buffers);
+      for (i = 0; i < n; i++)
+        {
+          if (prefetch)
+            {
+              lock_acquire (&cache_lock);
+              run[i]->prefetched = true;
+              prefetch_cnt++;
+              lock_release (&cache_lock);
+            }
+          cache_put (run[i], false);
+        }
+      if (cached)
+        n++;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Read-ahead thread.  Fetches queued sectors into the cache so
+   that sequential readers find them there instead of waiting
+   for the disk.  Consecutive queued sectors are fetched
+   together. */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      size_t cnt;
+
+      lock_acquire (&readahead_lock);
+      while (readahead_cnt == 0)
+        cond_wait (&readahead_ready, &readahead_lock);
+      sector = readahead_queue[readahead_head];
+      cnt = 0;
+      do
+        {
+          readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+          readahead_cnt--;
+          cnt++;
+        }
+      while (readahead_cnt > 0 && cnt < CACHE_RUN_MAX
+             && readahead_queue[readahead_head] == sector + cnt);
+      lock_release (&readahead_lock);
+
+      cache_load_run (sector, cnt, true);
+    }
+}
+
+/* Write-behind thread.  Periodically writes every dirty sector
+   back to disk, so that writers rarely wait for the disk.  The
+   journal, not this thread, protects metadata in a crash. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (cache_flush_interval);
+      cache_flush ();
+    }
+}
+
+/* Returns the entry holding SECTOR, or a null pointer if SECTOR
+   is not cached.  Must be called with cache_lock held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Returns true if SECTOR is still being written back from an
+   entry that was evicted to make room for another sector.
+   Must be called with cache_lock held. */
+static bool
+cache_writeback_pending (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].old_sector == sector)
+      return true;
+  return false;
+}
+
+/* Picks an unpinned entry to replace, using the clock
+   algorithm, or returns a null pointer if every entry is
+   pinned.  Must be called with cache_lock held. */
+static struct cache_entry *
+cache_evict (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (e->pin_cnt > 0 || e->journaled)
+        continue;
+      if (e->sector != CACHE_FREE && e->accessed)
+        {
+          e->accessed = false;
+          continue;
+        }
+      return e;
+    }
+  return NULL;
+}
+
+/* Returns the pinned and locked cache entry for SECTOR.  Sets
+   *HIT to true if SECTOR was already cached.  Otherwise, claims
+   an entry for SECTOR, writing back the sector it held if
+   necessary, and sets *HIT to false; the entry's data is then
+   garbage until the caller fills it in.  If no entry can be
+   replaced, waits for one if WAIT is true, otherwise returns a
+   null pointer.  The caller must release the entry with
+   cache_put(). */
+static struct cache_entry *
+cache_claim (block_sector_t sector, bool wait, bool *hit)
+{
+  struct cache_entry *e;
+  block_sector_t old_sector;
+  bool writeback;
+
+  ASSERT (sector != CACHE_FREE);
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          /* Hit.  Whoever is loading the entry holds its lock
+             until the data is valid. */
+          e->pin_cnt++;
+          e->accessed = true;
+          hit_cnt++;
+          if (e->prefetched)
+            {
+              e->prefetched = false;
+              prefetch_hit_cnt++;
+            }
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          *hit = true;
+          return e;
+        }
+
+      /* Don't read SECTOR from disk while an older copy of it is
+         still on its way out. */
+      if (cache_writeback_pending (sector))
+        {
+          cond_wait (&cache_written, &cache_lock);
+          continue;
+        }
+
+      e = cache_evict ();
+      if (e != NULL)
+        break;
+      if (!wait)
+        {
+          lock_release (&cache_lock);
+          return NULL;
+        }
+      cond_wait (&cache_unpinned, &cache_lock);
+    }
+
+  /* Claim the victim.  Its lock is free because it is unpinned. */
+  old_sector = e->sector;
+  writeback = old_sector != CACHE_FREE && e->dirty;
+  e->sector = sector;
+  e->old_sector = writeback ? old_sector : CACHE_FREE;
+  e->pin_cnt = 1;
+  e->accessed = true;
+  e->prefetched = false;
+  miss_cnt++;
+  lock_acquire (&e->lock);
+  lock_release (&cache_lock);
+
+  if (writeback)
+    {
+      block_write (fs_device, old_sector, e->data);
+      e->dirty = false;
+
+      lock_acquire (&cache_lock);
+      e->old_sector = CACHE_FREE;
+      cond_broadcast (&cache_written, &cache_lock);
+      lock_release (&cache_lock);
+    }
+  *hit = false;
+  return e;
+}
+
+/* Returns the pinned and locked cache entry for SECTOR, bringing
+   SECTOR into the cache if necessary.  If LOAD is false, the
+   caller promises to overwrite the entire sector, so its old
+   contents are not read from disk.  The caller must release the
+   entry with cache_put(). */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load)
+{
+  bool hit;
+  struct cache_entry *e = cache_claim (sector, true, &hit);
+
+  if (!hit && load)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* Releases entry E obtained from cache_get(), marking it dirty
+   if DIRTY is true. */
+static void
+cache_put (struct cache_entry *e, bool dirty)
+{
+  if (dirty)
+    e->dirty = true;
+  lock_release (&e->lock);
+  cache_unpin (e);
+}
+
+/* Drops a pin on E, whose lock the caller does not hold. */
+static void
+cache_unpin (struct cache_entry *e)
+{
+  lock_acquire (&cache_lock);
+  if (--e->pin_cnt == 0)
+    cond_broadcast (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Inserts E into ENTRIES, and its sector into SECTORS, which
+   hold CNT entries sorted by sector.  Insertion sort is fine for
+   this few entries.  Returns the new number of entries.  Must be
+   called with cache_lock held. */
+static size_t
+insert_sorted (block_sector_t sectors[], struct cache_entry *entries[],
+               size_t cnt, struct cache_entry *e)
+{
+  size_t j;
+
+  for (j = cnt; j > 0 && sectors[j - 1] > e->sector; j--)
+    {
+      sectors[j] = sectors[j - 1];
+      entries[j] = entries[j - 1];
+    }
+  sectors[j] = e->sector;
+  entries[j] = e;
+  return cnt + 1;
+}
+
+/* Writes back the CNT ENTRIES, which held the sectors in SECTORS
+   in ascending order when they were collected, then waits until
+   every write-back begun by eviction is on disk too. */
+static void
+write_back (const block_sector_t sectors[], struct cache_entry *entries[],
+            size_t cnt)
+{
+  size_t i = 0;
+
+  while (i < cnt)
+    {
+      struct flush_run runs[FLUSH_DEPTH];
+      size_t run_cnt = 0;
+      size_t pinned = 0;
+      size_t j, k;
+
+      /* Start writing up to FLUSH_DEPTH runs, so that the disk's
+         queue always has the next one at hand, then wait for
+         them.  At most FLUSH_PIN_MAX entries are pinned at once,
+         so a thread that needs an entry meanwhile can still
+         evict one. */
+      while (run_cnt < FLUSH_DEPTH && i < cnt && pinned < FLUSH_PIN_MAX)
+        {
+          struct flush_run *run = &runs[run_cnt];
+          block_sector_t start = sectors[i];
+          size_t n = 0;
+
+          /* Pin a run of entries that hold consecutive sectors,
+             skipping entries that were evicted, and therefore
+             written back, since we looked. */
+          lock_acquire (&cache_lock);
+          while (i < cnt && n < CACHE_RUN_MAX && pinned + n < FLUSH_PIN_MAX
+                 && sectors[i] == start + n)
+            {
+              struct cache_entry *e = entries[i++];
+              if (e->sector != sectors[i - 1])
+                break;
+              e->pin_cnt++;
+              run->entries[n++] = e;
+            }
+          lock_release (&cache_lock);
+          if (n == 0)
+            continue;
+
+          /* Entries that some other flush cleaned in the meantime
+             still match the disk, so rewriting them is harmless.
+             Locks are taken in ascending sector order, as in
+             cache_load_run().  The run ends early at an entry
+             that a journal transaction changed while we waited
+             for its lock. */
+          for (j = 0; j < n; j++)
+            {
+              struct cache_entry *e = run->entries[j];
+
+              lock_acquire (&e->lock);
+              if (e->journaled)
+                {
+                  lock_release (&e->lock);
+                  for (k = j; k < n; k++)
+                    cache_unpin (run->entries[k]);
+                  n = j;
+                  break;
+                }
+              run->buffers[j] = e->data;
+            }
+          if (n == 0)
+            continue;
+          pinned += n;
+          run->request.sector = start;
+          run->request.cnt = n;
+          run->request.write = true;
+          run->request.buffers = run->buffers;
+          run->request.complete = NULL;
+          block_submit (fs_device, &run->request);
+          run_cnt++;
+        }
+
+      for (k = 0; k < run_cnt; k++)
+        {
+          struct flush_run *run = &runs[k];
+
+          block_wait (&run->request);
+          for (j = 0; j < run->request.cnt; j++)
+            {
+              run->entries[j]->dirty = false;
+              cache_put (run->entries[j], false);
+            }
+        }
+    }
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    while (cache[i].old_sector != CACHE_FREE)
+      cond_wait (&cache_written, &cache_lock);
+  lock_release (&cache_lock);
+}
+
@@ -0,0 +1,32 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Read-ahead window in sectors.
+   Controlled by kernel command-line option "-ra=SECTORS". */
+extern size_t cache_readahead_window;
+
+/* Timer ticks between write-behind flushes.
+   Controlled by kernel command-line option "-wb=TICKS". */
+extern int64_t cache_flush_interval;
+
+void cache_init (void);
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, off_t size, off_t offset);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, off_t size, off_t offset);
+void cache_write_journaled_at (block_sector_t, const void *, off_t size,
+                               off_t offset);
+void cache_commit (block_sector_t);
+void cache_load (block_sector_t, size_t cnt);
+void cache_read_ahead (block_sector_t);
+void cache_flush (void);
+void cache_sync (const block_sector_t *, size_t cnt);
+void cache_done (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,173 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Maximum number of names held in the cache. */
+#define DCACHE_SIZE 256
+
+/* A cached result of looking up NAME in the directory whose
+   inode is in sector DIR.  SECTOR is the inode sector of the
+   named file, or DCACHE_ABSENT if the directory has no such
+   entry. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    block_sector_t dir;                 /* Directory inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t sector;              /* Inode sector or DCACHE_ABSENT. */
+  };
+
+static struct hash dentries;            /* All cached names. */
+static struct list lru_list;            /* Most recently used first. */
+static struct lock dcache_lock;         /* Protects all of the above. */
+
+/* Statistics, protected by dcache_lock. */
+static long long hit_cnt;               /* Lookups answered by the cache. */
+static long long negative_hit_cnt;      /* Hits on names known absent. */
+static long long miss_cnt;              /* Lookups that went to disk. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+static struct dentry *find (block_sector_t dir, const char *name);
+
+/* Initializes the dentry cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru_list);
+  lock_init (&dcache_lock);
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   Returns true and sets *SECTOR to the inode sector of NAME, or
+   to DCACHE_ABSENT if NAME is known not to exist, if the answer
+   is cached.  Returns false if it is not. */
+bool
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sector)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru_list, &d->lru_elem);
+      *sector = d->sector;
+      hit_cnt++;
+      if (d->sector == DCACHE_ABSENT)
+        negative_hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+
+  return d != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in sector
+   DIR has its inode in SECTOR, which may be DCACHE_ABSENT.
+   Evicts the least recently used name if the cache is full. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    list_remove (&d->lru_elem);
+  else if (hash_size (&dentries) >= DCACHE_SIZE)
+    {
+      d = list_entry (list_pop_back (&lru_list), struct dentry, lru_elem);
+      hash_delete (&dentries, &d->hash_elem);
+    }
+  else
+    d = malloc (sizeof *d);
+
+  if (d != NULL)
+    {
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      d->sector = sector;
+      hash_insert (&dentries, &d->hash_elem);
+      list_push_front (&lru_list, &d->lru_elem);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Forgets anything cached about NAME in the directory whose
+   inode is in sector DIR.  Must be called whenever an entry for
+   NAME is added to or removed from that directory. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      hash_delete (&dentries, &d->hash_elem);
+      list_remove (&d->lru_elem);
+      free (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints dentry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Dentry cache: %lld hits (%lld negative), %lld misses\n",
+          hit_cnt, negative_hit_cnt, miss_cnt);
+}
+
+/* Returns the cached dentry for NAME in DIR, or a null pointer
+   if there is none.  dcache_lock must be held. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&dcache_lock));
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Returns a hash value for the dentry at E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if the dentry at A precedes the one at B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
@@ -1,38 +1,109 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
-#include <list.h>
+#include <hash.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* A directory is a hash table of fixed-size slots stored in its
+   inode.  Slot 0 holds a header; the remaining SLOT_CNT slots are
+   addressed by hash of name, with collisions resolved by linear
+   probing.  Removed entries are left as tombstones so that
+   probe chains through them stay intact, and the table is
+   rebuilt into a larger one once it becomes too full. */
 
 /* A directory. */
-struct dir 
+struct dir
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
   };
 
-/* A single directory entry. */
-struct dir_entry 
+/* State of a directory slot. */
+enum slot_state
+  {
+    SLOT_FREE,                          /* Never used; ends a probe. */
+    SLOT_USED,                          /* Holds an entry. */
+    SLOT_DELETED                        /* Tombstone of a removed entry. */
+  };
+
+/* A single directory entry.
+   Padded to 32 bytes so that entries never straddle sectors. */
+struct dir_entry
   {
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
-    bool in_use;                        /* In use or free? */
+    uint8_t state;                      /* A slot_state. */
+    uint8_t unused[12];                 /* Not used. */
   };
 
+/* Directory header, stored in slot 0.
+   Must be exactly the same size as struct dir_entry. */
+struct dir_header
+  {
+    block_sector_t parent;              /* Sector of parent's inode. */
+    uint32_t slot_cnt;                  /* Number of hash slots. */
+    uint32_t used_cnt;                  /* Slots in state SLOT_USED. */
+    uint32_t deleted_cnt;               /* Slots in state SLOT_DELETED. */
+    uint8_t unused[16];                 /* Not used. */
+  };
+
+/* Rebuild the table once more than 3/4 of its slots are used or
+   deleted. */
+#define MAX_LOAD_NUM 3
+#define MAX_LOAD_DEN 4
+
+/* Returns the byte offset of hash slot IDX. */
+static inline off_t
+slot_ofs (uint32_t idx)
+{
+  return (idx + 1) * sizeof (struct dir_entry);
+}
+
+/* Returns the smallest slot count that holds ENTRY_CNT entries
+   without exceeding the maximum load. */
+static uint32_t
+slots_for (size_t entry_cnt)
+{
+  return entry_cnt * MAX_LOAD_DEN / MAX_LOAD_NUM + 1;
+}
+
+static bool read_header (const struct dir *, struct dir_header *);
+static bool write_header (struct dir *, const struct dir_header *);
+static bool rehash (struct dir *, struct dir_header *, uint32_t slot_cnt);
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, whose parent directory is in sector PARENT.
+   The directory grows as entries are added.
+   Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_header h;
+  struct dir *dir;
+  bool success;
+
+  memset (&h, 0, sizeof h);
+  h.parent = parent;
+  h.slot_cnt = slots_for (entry_cnt);
+  if (!inode_create (sector, slot_ofs (h.slot_cnt), true))
+    return false;
+
+  dir = dir_open (inode_open (sector));
+  if (dir == NULL)
+    return false;
+  success = write_header (dir, &h);
+  dir_close (dir);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
    it takes ownership.  Returns a null pointer on failure. */
 struct dir *
-dir_open (struct inode *inode) 
+dir_open (struct inode *inode)
 {
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
@@ -45,7 +116,7 @@ dir_open (struct inode *inode)
     {
       inode_close (inode);
       free (dir);
-      return NULL; 
+      return NULL;
     }
 }
 
@@ -57,17 +128,112 @@ dir_open_root (void)
   return dir_open (inode_open (ROOT_DIR_SECTOR));
 }
 
+/* Opens the current thread's working directory, which is the
+   root directory if none has been set.
+   Returns a null pointer on failure. */
+static struct dir *
+dir_open_cwd (void)
+{
+  struct dir *cwd = thread_current ()->cwd;
+  return cwd != NULL ? dir_reopen (cwd) : dir_open_root ();
+}
+
+/* Opens and returns the directory named by PATH, which is
+   resolved relative to the root directory if it begins with "/"
+   and relative to the current working directory otherwise.
+   Returns a null pointer if PATH does not name a directory or on
+   failure. */
+struct dir *
+dir_open_path (const char *path)
+{
+  char *copy, *token, *save_ptr;
+  struct dir *dir;
+
+  ASSERT (path != NULL);
+
+  copy = malloc (strlen (path) + 1);
+  if (copy == NULL)
+    return NULL;
+  strlcpy (copy, path, strlen (path) + 1);
+
+  dir = *path == '/' ? dir_open_root () : dir_open_cwd ();
+  for (token = strtok_r (copy, "/", &save_ptr); token != NULL && dir != NULL;
+       token = strtok_r (NULL, "/", &save_ptr))
+    {
+      struct inode *inode;
+
+      if (!dir_lookup (dir, token, &inode) || !inode_is_dir (inode))
+        {
+          inode_close (inode);
+          dir_close (dir);
+          dir = NULL;
+          break;
+        }
+      dir_close (dir);
+      dir = dir_open (inode);
+    }
+  free (copy);
+  return dir;
+}
+
+/* Splits PATH into the directory that contains its last
+   component and the component itself.  Opens and returns the
+   directory and copies the final component into NAME.  A path
+   with no final component, such as "/", names the directory
+   itself as ".".
+   Returns a null pointer if PATH is empty, if a component is
+   too long, if the containing directory does not exist, or on
+   failure. */
+struct dir *
+dir_open_parent (const char *path, char name[NAME_MAX + 1])
+{
+  const char *end, *last;
+  char *prefix;
+  struct dir *dir;
+  size_t len;
+
+  ASSERT (path != NULL);
+
+  if (*path == '\0')
+    return NULL;
+
+  /* Find the final component, ignoring trailing slashes. */
+  end = path + strlen (path);
+  while (end > path && end[-1] == '/')
+    end--;
+  last = end;
+  while (last > path && last[-1] != '/')
+    last--;
+
+  len = end - last;
+  if (len > NAME_MAX)
+    return NULL;
+  if (len == 0)
+    strlcpy (name, ".", NAME_MAX + 1);
+  else
+    strlcpy (name, last, len + 1);
+
+  /* Open everything before it. */
+  prefix = malloc (last - path + 1);
+  if (prefix == NULL)
+    return NULL;
+  strlcpy (prefix, path, last - path + 1);
+  dir = dir_open_path (prefix);
+  free (prefix);
+  return dir;
+}
+
 /* Opens and returns a new directory for the same inode as DIR.
    Returns a null pointer on failure. */
 struct dir *
-dir_reopen (struct dir *dir) 
+dir_reopen (struct dir *dir)
 {
   return dir_open (inode_reopen (dir->inode));
 }
 
 /* Destroys DIR and frees associated resources. */
 void
-dir_close (struct dir *dir) 
+dir_close (struct dir *dir)
 {
   if (dir != NULL)
     {
@@ -78,56 +244,115 @@ dir_close (struct dir *dir)
 
 /* Returns the inode encapsulated by DIR. */
 struct inode *
-dir_get_inode (struct dir *dir) 
+dir_get_inode (struct dir *dir)
 {
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
+/* Reads DIR's header into *H.
+   Returns true if successful, false on failure. */
+static bool
+read_header (const struct dir *dir, struct dir_header *h)
+{
+  return inode_read_at (dir->inode, h, sizeof *h, 0) == sizeof *h;
+}
+
+/* Writes *H as DIR's header.
+   Returns true if successful, false on failure. */
+static bool
+write_header (struct dir *dir, const struct dir_header *h)
+{
+  return inode_write_at (dir->inode, h, sizeof *h, 0) == sizeof *h;
+}
+
+/* Searches DIR, whose header is H, for a file with the given
+   NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   Otherwise, returns false, ignores EP, and sets *OFSP to the
+   offset of the slot where NAME should be inserted if OFSP is
+   non-null. */
 static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+lookup (const struct dir *dir, const struct dir_header *h,
+        const char *name, struct dir_entry *ep, off_t *ofsp)
 {
-  struct dir_entry e;
-  size_t ofs;
-  
+  off_t insert_ofs = -1;
+  uint32_t idx, i;
+
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  idx = hash_string (name) % h->slot_cnt;
+  for (i = 0; i < h->slot_cnt; i++, idx = (idx + 1) % h->slot_cnt)
+    {
+      struct dir_entry e;
+      off_t ofs = slot_ofs (idx);
+
+      if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+        break;
+      if (e.state == SLOT_USED && !strcmp (name, e.name))
+        {
+          if (ep != NULL)
+            *ep = e;
+          if (ofsp != NULL)
+            *ofsp = ofs;
+          return true;
+        }
+      if (e.state != SLOT_USED && insert_ofs < 0)
+        insert_ofs = ofs;
+      if (e.state == SLOT_FREE)
+        break;
+    }
+  if (ofsp != NULL)
+    *ofsp = insert_ofs;
   return false;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
+   "." and ".." name DIR itself and its parent.
+   Answers, including the absence of NAME, are remembered in the
+   dentry cache so that repeated lookups need not read DIR.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Fails if DIR has been removed. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
-            struct inode **inode) 
+            struct inode **inode)
 {
+  struct dir_header h;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  *inode = NULL;
+  inode_lock (dir->inode);
+  if (inode_is_removed (dir->inode))
+    ;
+  else if (!strcmp (name, "."))
+    *inode = inode_reopen (dir->inode);
+  else if (!strcmp (name, ".."))
+    {
+      if (read_header (dir, &h))
+        *inode = inode_open (h.parent);
+    }
   else
-    *inode = NULL;
+    {
+      block_sector_t dir_sector = inode_get_inumber (dir->inode);
+      block_sector_t sector;
+
+      if (!dcache_lookup (dir_sector, name, &sector))
+        {
+          sector = (read_header (dir, &h) && lookup (dir, &h, name, &e, NULL)
+                    ? e.inode_sector : DCACHE_ABSENT);
+          dcache_insert (dir_sector, name, sector);
+        }
+      if (sector != DCACHE_ABSENT)
+        *inode = inode_open (sector);
+    }
+  inode_unlock (dir->inode);
 
   return *inode != NULL;
 }
@@ -136,11 +361,12 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long, "." or ".."), if DIR
+   has been removed, or if a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_header h;
   struct dir_entry e;
   off_t ofs;
   bool success = false;
@@ -149,43 +375,134 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   ASSERT (name != NULL);
 
   /* Check NAME for validity. */
-  if (*name == '\0' || strlen (name) > NAME_MAX)
+  if (*name == '\0' || strlen (name) > NAME_MAX
+      || !strcmp (name, ".") || !strcmp (name, ".."))
     return false;
 
+  inode_lock (dir->inode);
+  if (inode_is_removed (dir->inode) || !read_header (dir, &h))
+    goto done;
+
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  if (lookup (dir, &h, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
-  e.in_use = true;
+  /* Make room if adding an entry would overload the table.
+     Tombstones count against the load, so a table with many of
+     them is rebuilt at the same size. */
+  if ((h.used_cnt + h.deleted_cnt + 1) * MAX_LOAD_DEN
+      > h.slot_cnt * MAX_LOAD_NUM)
+    {
+      uint32_t slot_cnt = h.slot_cnt;
+      if ((h.used_cnt + 1) * MAX_LOAD_DEN > slot_cnt * MAX_LOAD_NUM / 2)
+        slot_cnt = slot_cnt * 2 + 1;
+      if (!rehash (dir, &h, slot_cnt))
+        goto done;
+    }
+
+  /* Find the slot and fill it. */
+  lookup (dir, &h, name, NULL, &ofs);
+  if (ofs < 0 || inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+    goto done;
+  if (e.state == SLOT_DELETED)
+    h.deleted_cnt--;
+  memset (&e, 0, sizeof e);
+  e.state = SLOT_USED;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+    goto done;
+
+  h.used_cnt++;
+  success = write_header (dir, &h);
 
  done:
+  inode_unlock (dir->inode);
   return success;
 }
 
+/* Rebuilds DIR's hash table, whose current header is *H, with
+   SLOT_CNT slots, dropping all tombstones.  Updates *H and the
+   header on disk to match.
+   Returns true if successful, false on failure. */
+static bool
+rehash (struct dir *dir, struct dir_header *h, uint32_t slot_cnt)
+{
+  struct dir_entry *entries, e;
+  size_t entry_cnt = 0;
+  uint32_t idx;
+  bool success = false;
+
+  entries = malloc (h->used_cnt * sizeof *entries);
+  if (entries == NULL && h->used_cnt > 0)
+    return false;
+
+  /* Collect the live entries and clear the old table. */
+  for (idx = 0; idx < h->slot_cnt; idx++)
+    {
+      if (inode_read_at (dir->inode, &e, sizeof e, slot_ofs (idx)) != sizeof e)
+        goto done;
+      if (e.state == SLOT_USED && entry_cnt < h->used_cnt)
+        entries[entry_cnt++] = e;
+      if (e.state != SLOT_FREE)
+        {
+          memset (&e, 0, sizeof e);
+          if (inode_write_at (dir->inode, &e, sizeof e, slot_ofs (idx))
+              != sizeof e)
+            goto done;
+        }
+    }
+
+  /* Extend the table.  Slots beyond the old end read as zeros,
+     which is SLOT_FREE, so only the last one need be written. */
+  if (slot_cnt > h->slot_cnt)
+    {
+      memset (&e, 0, sizeof e);
+      if (inode_write_at (dir->inode, &e, sizeof e, slot_ofs (slot_cnt - 1))
+          != sizeof e)
+        goto done;
+    }
+
+  /* Reinsert the entries. */
+  h->slot_cnt = slot_cnt;
+  h->used_cnt = entry_cnt;
+  h->deleted_cnt = 0;
+  while (entry_cnt-- > 0)
+    {
+      struct dir_entry *ep = &entries[entry_cnt];
+      off_t ofs;
+
+      if (lookup (dir, h, ep->name, NULL, &ofs) || ofs < 0
+          || inode_write_at (dir->inode, ep, sizeof *ep, ofs) != sizeof *ep)
+        goto done;
+    }
+  success = write_header (dir, h);
+
+ done:
+  free (entries);
+  return success;
+}
+
+/* Returns true if DIR contains no entries, false otherwise. */
+static bool
+dir_is_empty (const struct dir *dir)
+{
+  struct dir_header h;
+  return read_header (dir, &h) && h.used_cnt == 0;
+}
+
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs if there is no file with the given NAME or if
+   NAME is a directory that is not empty. */
 bool
-dir_remove (struct dir *dir, const char *name) 
+dir_remove (struct dir *dir, const char *name)
 {
+  struct dir_header h;
   struct dir_entry e;
   struct inode *inode = NULL;
+  struct dir *victim = NULL;
   bool success = false;
   off_t ofs;
 
@@ -193,7 +510,8 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  inode_lock (dir->inode);
+  if (!read_header (dir, &h) || !lookup (dir, &h, name, &e, &ofs))
     goto done;
 
   /* Open inode. */
@@ -201,9 +519,29 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
-  /* Erase directory entry. */
-  e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  /* Only empty directories may be removed.  The victim stays
+     locked until it is marked removed, so that no entry can be
+     added to it in between.  Locks are always taken parent
+     first. */
+  if (inode_is_dir (inode))
+    {
+      victim = dir_open (inode_reopen (inode));
+      if (victim == NULL)
+        goto done;
+      inode_lock (inode);
+      if (!dir_is_empty (victim))
+        goto done;
+    }
+
+  /* Erase directory entry.  A removed directory is empty, so no
+     names in it remain in the dentry cache either. */
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  e.state = SLOT_DELETED;
+  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+    goto done;
+  h.used_cnt--;
+  h.deleted_cnt++;
+  if (!write_header (dir, &h))
     goto done;
 
   /* Remove inode. */
@@ -211,26 +549,56 @@ dir_remove (struct dir *dir, const char *name)
   success = true;
 
  done:
+  if (victim != NULL)
+    {
+      inode_unlock (inode);
+      dir_close (victim);
+    }
+  inode_unlock (dir->inode);
   inode_close (inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  "." and ".." are not returned. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool success = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  inode_lock (dir->inode);
+  if (dir->pos < (off_t) sizeof e)
+    dir->pos = sizeof e;
+  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
     {
       dir->pos += sizeof e;
-      if (e.in_use)
+      if (e.state == SLOT_USED)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
+          success = true;
+          break;
+        }
     }
-  return false;
+  inode_unlock (dir->inode);
+  return success;
+}
+
+/* Sets DIR's position for dir_readdir() to POS, a value
+   previously returned by dir_tell(). */
+void
+dir_seek (struct dir *dir, off_t pos)
+{
+  ASSERT (dir != NULL);
+  ASSERT (pos >= 0);
+  dir->pos = pos;
+}
+
+/* Returns DIR's position for dir_readdir(). */
+off_t
+dir_tell (struct dir *dir)
+{
+  ASSERT (dir != NULL);
+  return dir->pos;
 }
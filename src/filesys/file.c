@@ -1,5 +1,6 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "filesys/cache.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
@@ -9,8 +10,12 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t seq_pos;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of data already read ahead. */
   };
 
+static void file_read_ahead (struct file *);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +28,8 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->seq_pos = 0;
+      file->ra_end = 0;
       return file;
     }
   else
@@ -64,15 +71,38 @@ file_get_inode (struct file *file)
    starting at the file's current position.
    Returns the number of bytes actually read,
    which may be less than SIZE if end of file is reached.
-   Advances FILE's position by the number of bytes read. */
+   Advances FILE's position by the number of bytes read.
+   A read that starts where the previous one ended also starts
+   fetching the data that follows it in the background. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
+  bool sequential = file->pos == file->seq_pos;
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->seq_pos = file->pos;
+  if (!sequential)
+    file->ra_end = file->pos;
+  else if (bytes_read > 0)
+    file_read_ahead (file);
   return bytes_read;
 }
 
+/* Extends the read-ahead window of FILE so that it covers
+   cache_readahead_window sectors past the current position. */
+static void
+file_read_ahead (struct file *file)
+{
+  off_t end = file->pos + (off_t) cache_readahead_window * BLOCK_SECTOR_SIZE;
+  off_t start = file->ra_end > file->pos ? file->ra_end : file->pos;
+
+  if (start < end)
+    {
+      inode_read_ahead (file->inode, start, end - start);
+      file->ra_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -85,11 +115,10 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
-   starting at the file's current position.
+   starting at the file's current position, growing the file if
+   the write extends past end of file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -100,11 +129,10 @@ file_write (struct file *file, const void *buffer, off_t size)
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
-   starting at offset FILE_OFS in the file.
+   starting at offset FILE_OFS in the file, growing the file if
+   the write extends past end of file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
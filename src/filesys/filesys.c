@@ -2,15 +2,20 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
 static void do_format (void);
+static bool names_dir (const char *name);
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -21,13 +26,18 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
-  inode_init ();
   free_map_init ();
+  cache_init ();
+  inode_init ();
+  dcache_init ();
+  journal_init ();
 
   if (format) 
     do_format ();
 
+  journal_recover ();
   free_map_open ();
+  journal_open ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -35,69 +45,172 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  journal_done ();
   free_map_close ();
+  cache_done ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
+   NAME may be a path relative to the current directory or, if it
+   begins with "/", to the root directory.
    Returns true if successful, false otherwise.
-   Fails if a file named NAME already exists,
+   Fails if a file named NAME already exists, if NAME ends in "/",
    or if internal memory allocation fails. */
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
+  char base[NAME_MAX + 1];
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  struct dir *dir;
+  bool success;
+
+  if (names_dir (name))
+    return false;
+
+  journal_begin ();
+  dir = dir_open_parent (name, base);
+  success = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && inode_create (inode_sector, initial_size, false)
+             && dir_add (dir, base, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
+
+  return success;
+}
+
+/* Creates a directory named NAME, which is resolved like
+   filesys_create()'s argument.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  char base[NAME_MAX + 1];
+  block_sector_t inode_sector = 0;
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_parent (name, base);
+  success = dir != NULL && free_map_allocate (1, &inode_sector);
+  if (success)
+    {
+      block_sector_t parent = inode_get_inumber (dir_get_inode (dir));
+      if (!dir_create (inode_sector, 16, parent))
+        {
+          free_map_release (inode_sector, 1);
+          success = false;
+        }
+      else if (!dir_add (dir, base, inode_sector))
+        {
+          /* Release the new directory's data along with its
+             inode. */
+          struct inode *inode = inode_open (inode_sector);
+          if (inode != NULL)
+            inode_remove (inode);
+          inode_close (inode);
+          success = false;
+        }
+    }
+  dir_close (dir);
+  journal_end ();
 
   return success;
 }
 
-/* Opens the file with the given NAME.
+/* Opens the file with the given NAME, which may be a directory.
    Returns the new file if successful or a null pointer
    otherwise.
-   Fails if no file named NAME exists,
+   Fails if no file named NAME exists, if NAME ends in "/" but
+   names a file that is not a directory,
    or if an internal memory allocation fails. */
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  char base[NAME_MAX + 1];
+  struct dir *dir = dir_open_parent (name, base);
   struct inode *inode = NULL;
 
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    dir_lookup (dir, base, &inode);
   dir_close (dir);
+  if (inode != NULL && !inode_is_dir (inode) && names_dir (name))
+    {
+      inode_close (inode);
+      inode = NULL;
+    }
 
   return file_open (inode);
 }
 
 /* Deletes the file named NAME.
    Returns true if successful, false on failure.
-   Fails if no file named NAME exists,
+   Fails if no file named NAME exists, if NAME is a directory
+   that is not empty or is the root directory, if NAME ends in "/"
+   but names a file that is not a directory,
    or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char base[NAME_MAX + 1];
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_parent (name, base);
+  success = dir != NULL;
+  if (success && names_dir (name))
+    {
+      /* Only a directory may be named with a trailing slash. */
+      struct inode *inode = NULL;
+      success = dir_lookup (dir, base, &inode) && inode_is_dir (inode);
+      inode_close (inode);
+    }
+  success = success && dir_remove (dir, base);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
+
+/* Changes the current thread's working directory to NAME.
+   Returns true if successful, false if NAME is not a directory
+   or on failure. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *t = thread_current ();
+  struct dir *dir = dir_open_path (name);
+
+  if (dir == NULL)
+    return false;
+  dir_close (t->cwd);
+  t->cwd = dir;
+  return true;
+}
 
+/* Returns true if NAME ends in "/", so that its final component
+   must be a directory. */
+static bool
+names_dir (const char *name)
+{
+  size_t len = strlen (name);
+  return len > 0 && name[len - 1] == '/';
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
+  journal_create ();
   free_map_close ();
   printf ("done.\n");
 }
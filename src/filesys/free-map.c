@@ -1,12 +1,50 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <string.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
+
+/* Number of free map bits in a sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *free_map_changed;  /* Sectors of the free map
+                                            file changed since last
+                                            written, one bit each. */
+static struct bitmap *free_map_pending;  /* Sectors released by the
+                                            running transaction, one
+                                            bit per sector. */
+static size_t pending_cnt;           /* Number of pending sectors. */
+static size_t free_map_cursor;       /* Where the next scan starts. */
+static struct lock free_map_lock;    /* Protects all of the above. */
+
+/* A run of free sectors remembered from an earlier release. */
+struct free_extent
+  {
+    block_sector_t start;            /* First sector. */
+    size_t cnt;                      /* Number of sectors. */
+  };
+
+/* Summaries of recently released extents, by size class: class
+   K holds extents of 2**K to 2**(K+1) - 1 sectors, except that
+   the last class holds all larger extents.  An extent may have
+   been reallocated since it was recorded, so each one is
+   checked against the bitmap before use. */
+#define EXTENT_CLASS_CNT 8
+#define EXTENTS_PER_CLASS 4
+static struct free_extent free_extents[EXTENT_CLASS_CNT][EXTENTS_PER_CLASS];
+static size_t free_extent_cnt[EXTENT_CLASS_CNT];
+
+static void remember_extent (block_sector_t start, size_t cnt);
+static block_sector_t take_extent (size_t cnt);
+static void mark_changed (block_sector_t start, size_t cnt);
+static off_t sector_image (size_t idx, uint8_t image[BLOCK_SECTOR_SIZE]);
 
 /* Initializes the free map. */
 void
@@ -17,36 +55,163 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, JOURNAL_SECTOR);
+  free_map_changed = bitmap_create (free_map_sector_cnt ());
+  free_map_pending = bitmap_create (block_size (fs_device));
+  if (free_map_changed == NULL || free_map_pending == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  free_map_cursor = 0;
+  lock_init (&free_map_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.
+
+   Allocation first tries a recently released extent of a
+   suitable size, then scans for a free run starting where the
+   previous allocation ended (next fit).  The change reaches the
+   free map file when the journal next commits, or at the next
+   free_map_flush() if the journal is not running. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = take_extent (cnt);
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan (free_map, free_map_cursor, cnt, false);
+  if (sector == BITMAP_ERROR && free_map_cursor > 0)
+    sector = bitmap_scan (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      free_map_cursor = (sector + cnt) % bitmap_size (free_map);
+      mark_changed (sector, cnt);
+      *sectorp = sector;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use.
+
+   While the journal runs, the sectors are freed on disk by the
+   running transaction, but are not handed out again until
+   free_map_commit() says that the transaction has committed.
+   Otherwise a sector that the transaction took away from a file,
+   such as an index block, could be filled with new data before
+   the commit, and a crash would leave the old file pointing at
+   it. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  bool deferred = journal_release (sector, cnt);
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  ASSERT (bitmap_none (free_map_pending, sector, cnt));
+  if (deferred)
+    {
+      bitmap_set_multiple (free_map_pending, sector, cnt, true);
+      pending_cnt += cnt;
+    }
+  else
+    {
+      bitmap_set_multiple (free_map, sector, cnt, false);
+      remember_extent (sector, cnt);
+    }
+  mark_changed (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Makes the sectors that the transaction just committed, or
+   checkpointed, released available for allocation.  Called by
+   the journal once the transaction can no longer be rolled
+   back. */
+void
+free_map_commit (void)
+{
+  size_t sector = 0;
+
+  lock_acquire (&free_map_lock);
+  while (pending_cnt > 0)
+    {
+      size_t end;
+
+      sector = bitmap_scan (free_map_pending, sector, 1, true);
+      ASSERT (sector != BITMAP_ERROR);
+      end = bitmap_scan (free_map_pending, sector, 1, false);
+      if (end == BITMAP_ERROR)
+        end = bitmap_size (free_map_pending);
+
+      bitmap_set_multiple (free_map_pending, sector, end - sector, false);
+      bitmap_set_multiple (free_map, sector, end - sector, false);
+      remember_extent (sector, end - sector);
+      pending_cnt -= end - sector;
+      sector = end;
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Returns the number of sectors in the free map file. */
+size_t
+free_map_sector_cnt (void)
+{
+  return DIV_ROUND_UP (bitmap_file_size (free_map), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes each sector of the free map file that has changed since
+   it was last written. */
+void
+free_map_flush (void)
+{
+  static uint8_t image[BLOCK_SECTOR_SIZE];
+  size_t idx;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (idx = 0; idx < bitmap_size (free_map_changed); idx++)
+      if (bitmap_test (free_map_changed, idx))
+        {
+          off_t size = sector_image (idx, image);
+          if (file_write_at (free_map_file, image, size,
+                             idx * BLOCK_SECTOR_SIZE) != size)
+            PANIC ("can't write free map");
+          bitmap_reset (free_map_changed, idx);
+        }
+  lock_release (&free_map_lock);
+}
+
+/* Copies each sector of the free map file that has changed since
+   it was last written or collected into consecutive elements of
+   IMAGES, which must have room for free_map_sector_cnt()
+   sectors, and stores the file system sector that holds it in
+   the corresponding element of SECTORS.  The caller becomes
+   responsible for writing the images.  Returns the number of
+   sectors copied. */
+size_t
+free_map_collect (block_sector_t sectors[],
+                  uint8_t images[][BLOCK_SECTOR_SIZE])
+{
+  struct inode *inode = file_get_inode (free_map_file);
+  size_t cnt = 0;
+  size_t idx;
+
+  lock_acquire (&free_map_lock);
+  for (idx = 0; idx < bitmap_size (free_map_changed); idx++)
+    if (bitmap_test (free_map_changed, idx))
+      {
+        memset (images[cnt], 0, BLOCK_SECTOR_SIZE);
+        sector_image (idx, images[cnt]);
+        sectors[cnt] = inode_get_sector (inode, idx * BLOCK_SECTOR_SIZE);
+        cnt++;
+        bitmap_reset (free_map_changed, idx);
+      }
+  lock_release (&free_map_lock);
+  return cnt;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,22 +223,29 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (free_map_changed, false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
   file_close (free_map_file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
-   it. */
+   it.  Writing the file allocates its sectors, which leaves the
+   free map dirty, so the final free_map_close() writes it once
+   more with those allocations recorded. */
 void
 free_map_create (void) 
 {
-  /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  /* Create inode.  Its length is rounded up to a whole sector so
+     that it is never inline: the journal logs it by sector. */
+  if (!inode_create (FREE_MAP_SECTOR,
+                     ROUND_UP (bitmap_file_size (free_map),
+                               BLOCK_SECTOR_SIZE), false))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
@@ -83,3 +255,117 @@ free_map_create (void)
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
+
+/* Records that the free map bits for the CNT sectors starting at
+   START have changed.
+   Must be called with free_map_lock held. */
+static void
+mark_changed (block_sector_t start, size_t cnt)
+{
+  size_t first = start / BITS_PER_SECTOR;
+  size_t last = (start + cnt - 1) / BITS_PER_SECTOR;
+
+  bitmap_set_multiple (free_map_changed, first, last - first + 1, true);
+}
+
+/* Fills IMAGE with sector IDX of the free map file, in the
+   format that bitmap_write() uses, and returns the number of
+   bytes of the file that it covers.  Bytes past that are left
+   alone.  Pending sectors are free on disk.
+   Must be called with free_map_lock held. */
+static off_t
+sector_image (size_t idx, uint8_t image[BLOCK_SECTOR_SIZE])
+{
+  size_t first = idx * BITS_PER_SECTOR;
+  size_t end = first + BITS_PER_SECTOR;
+  off_t size = bitmap_file_size (free_map) - idx * BLOCK_SECTOR_SIZE;
+  size_t bit;
+
+  if (end > bitmap_size (free_map))
+    end = bitmap_size (free_map);
+  if (size > BLOCK_SECTOR_SIZE)
+    size = BLOCK_SECTOR_SIZE;
+  memset (image, 0, size);
+  for (bit = first; bit < end; bit++)
+    if (bitmap_test (free_map, bit) && !bitmap_test (free_map_pending, bit))
+      image[(bit - first) / 8] |= 1 << (bit % 8);
+  return size;
+}
+
+/* Returns the size class of an extent of CNT sectors. */
+static size_t
+extent_class (size_t cnt)
+{
+  size_t class = 0;
+
+  ASSERT (cnt > 0);
+  while (cnt > 1 && class < EXTENT_CLASS_CNT - 1)
+    {
+      cnt /= 2;
+      class++;
+    }
+  return class;
+}
+
+/* Records that CNT sectors starting at START are free.  If the
+   summary for their size class is full, the extent is simply not
+   remembered; the next-fit scan will still find it.
+   Must be called with free_map_lock held. */
+static void
+remember_extent (block_sector_t start, size_t cnt)
+{
+  size_t class = extent_class (cnt);
+
+  if (free_extent_cnt[class] < EXTENTS_PER_CLASS)
+    {
+      struct free_extent *e = &free_extents[class][free_extent_cnt[class]++];
+      e->start = start;
+      e->cnt = cnt;
+    }
+}
+
+/* Removes the Ith extent from the summary for CLASS. */
+static void
+forget_extent (size_t class, size_t i)
+{
+  free_extents[class][i] = free_extents[class][--free_extent_cnt[class]];
+}
+
+/* Finds a remembered extent of at least CNT free sectors, takes
+   CNT sectors from its front and returns the first of them, or
+   returns BITMAP_ERROR if no remembered extent fits.  The
+   sectors are not marked in use.
+   Must be called with free_map_lock held. */
+static block_sector_t
+take_extent (size_t cnt)
+{
+  size_t class;
+
+  for (class = extent_class (cnt); class < EXTENT_CLASS_CNT; class++)
+    {
+      size_t i = 0;
+
+      while (i < free_extent_cnt[class])
+        {
+          struct free_extent e = free_extents[class][i];
+
+          if (!bitmap_none (free_map, e.start, e.cnt < cnt ? e.cnt : cnt))
+            {
+              /* Reallocated since it was released. */
+              forget_extent (class, i);
+              continue;
+            }
+          if (e.cnt < cnt)
+            {
+              i++;
+              continue;
+            }
+
+          forget_extent (class, i);
+          if (e.cnt > cnt)
+            remember_extent (e.start + cnt, e.cnt - cnt);
+          return e.start;
+        }
+    }
+  return BITMAP_ERROR;
+}
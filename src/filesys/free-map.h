@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include "devices/block.h"
 
 void free_map_init (void);
@@ -10,8 +11,13 @@ void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_flush (void);
+size_t free_map_sector_cnt (void);
+size_t free_map_collect (block_sector_t sectors[],
+                         uint8_t images[][BLOCK_SECTOR_SIZE]);
 
 bool free_map_allocate (size_t, block_sector_t *);
 void free_map_release (block_sector_t, size_t);
+void free_map_commit (void);
 
 #endif /* filesys/free-map.h */
@@ -110,7 +110,12 @@ fsutil_extract (char **argv UNUSED)
           break;
         }
       else if (type == USTAR_DIRECTORY)
-        printf ("ignoring directory %s\n", file_name);
+        {
+          printf ("Putting directory '%s' into the file system...\n",
+                  file_name);
+          if (!filesys_mkdir (file_name))
+            PANIC ("%s: mkdir failed", file_name);
+        }
       else if (type == USTAR_REGULAR)
         {
           struct file *dst;
@@ -1,76 +1,264 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of sector numbers in the inode itself, and in each
+   indirect block. */
+#define DIRECT_CNT 123
+#define INDIRECT_CNT (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Sector number stored for a block that has not been allocated.
+   Sector 0 holds the free map inode, so it is never file data. */
+#define NO_SECTOR 0
+
+/* Most sectors that inode_read_at() brings into the cache ahead
+   of copying them out. */
+#define LOAD_MAX 16
+
+/* Number of bytes of data that an inline file keeps in place of
+   its sector pointers. */
+#define INLINE_MAX ((off_t) ((DIRECT_CNT + 2) * sizeof (block_sector_t)))
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Data sectors are found through DIRECT_CNT direct pointers,
+   then one indirect block of INDIRECT_CNT pointers, then one
+   doubly indirect block of INDIRECT_CNT indirect blocks.  Any
+   pointer may be NO_SECTOR: index blocks and data sectors are
+   only allocated once something is written to them, and reading
+   a hole yields zeros.
+
+   A file created with no more than INLINE_MAX bytes is inline:
+   it keeps its data in the inode, in place of the pointers, and
+   so costs neither a sector of its own nor a read beyond the
+   inode's.  The first write that takes it past INLINE_MAX bytes
+   moves the data out to a sector. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    union
+      {
+        struct
+          {
+            block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+            block_sector_t indirect;            /* Indirect block. */
+            block_sector_t doubly_indirect;     /* Doubly indirect block. */
+          };
+        uint8_t inline_data[INLINE_MAX];        /* Data of inline file. */
+      };
+    uint16_t is_dir;                    /* 1 for a directory, 0 otherwise. */
+    uint16_t is_inline;                 /* 1 for an inline file, 0 otherwise. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
-
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool loading;                       /* True until data is read. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rw;                   /* Held for reading to read data,
+                                           for writing to write it. */
+    struct lock lock;                   /* See inode_lock(). */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Allocates a sector, fills it with zeros and stores its number
+   in *SECTORP.  The zeros are journaled if META is true, because
+   the sector is to hold metadata.  Returns true if successful,
+   false if the disk is full. */
+static bool
+allocate_sector (block_sector_t *sectorp, bool meta)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate (1, sectorp))
+    return false;
+  if (meta)
+    journal_write (*sectorp, zeros);
+  else
+    {
+      cache_write (*sectorp, zeros);
+      journal_order (*sectorp);
+    }
+  return true;
+}
+
+/* Returns the sector number that INODE's on-disk inode stores in
+   *SLOT.  If it is NO_SECTOR and CREATE is true, allocates a
+   zeroed sector, which holds metadata if META is true, records
+   it in *SLOT and writes the inode back.
+   Returns NO_SECTOR if the sector is absent and not created. */
+static block_sector_t
+inode_slot (struct inode *inode, block_sector_t *slot, bool create,
+            bool meta)
+{
+  if (*slot == NO_SECTOR && create && allocate_sector (slot, meta))
+    journal_write (inode->sector, &inode->data);
+  return *slot;
+}
+
+/* Returns the sector number stored at index IDX of indirect
+   block INDEX_SECTOR, allocating a zeroed sector for it if it is
+   NO_SECTOR and CREATE is true.  The new sector holds metadata
+   if META is true.  Returns NO_SECTOR if the sector is absent
+   and not created. */
+static block_sector_t
+index_slot (block_sector_t index_sector, size_t idx, bool create,
+            bool meta)
+{
+  block_sector_t sector;
+
+  ASSERT (idx < INDIRECT_CNT);
+
+  cache_read_at (index_sector, &sector, sizeof sector, idx * sizeof sector);
+  if (sector == NO_SECTOR && create && allocate_sector (&sector, meta))
+    journal_write_at (index_sector, &sector, sizeof sector,
+                      idx * sizeof sector);
+  return sector;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE.  If no sector has been allocated there yet and
+   CREATE is true, allocates one (and any index blocks needed to
+   reach it).  Data sectors of a directory are metadata, and
+   those of other files are not.
+   Returns NO_SECTOR if INODE has no data sector for offset POS,
+   because it is a hole that was not created, because the disk is
+   full, because POS is beyond the maximum file size, or because
+   INODE is inline. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, bool create) 
 {
+  struct inode_disk *disk = &inode->data;
+  bool is_dir = disk->is_dir != 0;
+  size_t idx;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  ASSERT (pos >= 0);
+
+  if (disk->is_inline)
+    {
+      ASSERT (!create);
+      return NO_SECTOR;
+    }
+
+  idx = pos / BLOCK_SECTOR_SIZE;
+  if (idx < DIRECT_CNT)
+    return inode_slot (inode, &disk->direct[idx], create, is_dir);
+
+  idx -= DIRECT_CNT;
+  if (idx < INDIRECT_CNT)
+    {
+      block_sector_t ind = inode_slot (inode, &disk->indirect, create, true);
+      return (ind != NO_SECTOR ? index_slot (ind, idx, create, is_dir)
+              : NO_SECTOR);
+    }
+
+  idx -= INDIRECT_CNT;
+  if (idx < INDIRECT_CNT * INDIRECT_CNT)
+    {
+      block_sector_t dbl, ind;
+
+      dbl = inode_slot (inode, &disk->doubly_indirect, create, true);
+      if (dbl == NO_SECTOR)
+        return NO_SECTOR;
+      ind = index_slot (dbl, idx / INDIRECT_CNT, create, true);
+      if (ind == NO_SECTOR)
+        return NO_SECTOR;
+      return index_slot (ind, idx % INDIRECT_CNT, create, is_dir);
+    }
+
+  return NO_SECTOR;
+}
+
+/* Releases SECTOR, which must be NO_SECTOR or a sector of file
+   data or index block at indirection LEVEL (0 for data, 1 for an
+   indirect block, 2 for a doubly indirect block), along with
+   every sector it points to. */
+static void
+release_tree (block_sector_t sector, int level)
+{
+  if (sector == NO_SECTOR)
+    return;
+
+  if (level > 0)
+    {
+      block_sector_t *index = malloc (BLOCK_SECTOR_SIZE);
+      size_t i;
+
+      if (index == NULL)
+        PANIC ("out of memory releasing inode blocks");
+      cache_read (sector, index);
+      for (i = 0; i < INDIRECT_CNT; i++)
+        release_tree (index[i], level - 1);
+      free (index);
+    }
+  free_map_release (sector, 1);
+}
+
+/* Releases every data and index sector of DISK. */
+static void
+release_sectors (const struct inode_disk *disk)
+{
+  size_t i;
+
+  if (disk->is_inline)
+    return;
+  for (i = 0; i < DIRECT_CNT; i++)
+    release_tree (disk->direct[i], 0);
+  release_tree (disk->indirect, 1);
+  release_tree (disk->doubly_indirect, 2);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt, removed and loading
+   members of every open inode. */
+static struct lock open_inodes_lock;
+
+/* Signaled when an inode finishes loading. */
+static struct condition inode_loaded;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
+  cond_init (&inode_loaded);
 }
 
-/* Initializes an inode with LENGTH bytes of data and
-   writes the new inode to sector SECTOR on the file system
-   device.
+/* Initializes an inode with LENGTH bytes of data and writes the
+   new inode to sector SECTOR on the file system device.  The
+   inode is for a directory if IS_DIR is true, otherwise for an
+   ordinary file.  No data sectors are allocated: the file reads as
+   zeros until it is written.  If LENGTH is at most INLINE_MAX,
+   the data is kept inline.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -84,22 +272,12 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      disk_inode->is_dir = is_dir;
+      disk_inode->is_inline = length <= INLINE_MAX;
+      journal_write (sector, disk_inode);
+      success = true; 
       free (disk_inode);
     }
   return success;
@@ -111,33 +289,49 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
-    {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
-    }
-
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
     return NULL;
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Check whether this inode is already open.  hash_insert()
+     returns the existing element instead of inserting a
+     duplicate. */
   inode->sector = sector;
+  lock_acquire (&open_inodes_lock);
+  e = hash_insert (&open_inodes, &inode->elem);
+  if (e != NULL)
+    {
+      /* Wait for whoever inserted it to finish reading it. */
+      free (inode);
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      while (inode->loading)
+        cond_wait (&inode_loaded, &open_inodes_lock);
+      lock_release (&open_inodes_lock);
+      return inode;
+    }
+
+  /* Initialize.  The inode is marked as loading, so that a
+     concurrent opener waits for its data without holding
+     open_inodes_lock against every other open while we read. */
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->loading = true;
+  rwlock_init (&inode->rw);
+  lock_init (&inode->lock);
+  lock_release (&open_inodes_lock);
+
+  cache_read (inode->sector, &inode->data);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode_loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +340,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -163,51 +361,151 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          journal_begin ();
+          release_sectors (&inode->data);
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          journal_end ();
         }
 
       free (inode); 
     }
 }
 
+/* Returns true if INODE is a directory, false if it is an
+   ordinary file. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
    has it open. */
 void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&open_inodes_lock);
   inode->removed = true;
+  lock_release (&open_inodes_lock);
+}
+
+/* Acquires INODE's lock, which callers use to make a sequence of
+   reads and writes of INODE atomic with respect to one another.
+   Directories hold it across every operation.  It is separate
+   from the lock that inode_read_at() and inode_write_at() take
+   internally, so those may be called while it is held. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+}
+
+/* Releases INODE's lock. */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->lock);
+}
+
+/* Brings the sectors that hold the SIZE bytes of INODE starting
+   at OFFSET into the buffer cache, reading each run of
+   consecutive sectors with a single request.  Bytes past end of
+   file are ignored. */
+static void
+inode_load (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+  block_sector_t start = NO_SECTOR;
+  size_t cnt = 0;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset, false);
+      if (cnt > 0 && sector != NO_SECTOR && sector == start + cnt)
+        cnt++;
+      else
+        {
+          /* Single sectors are read when they are copied out. */
+          if (cnt > 1)
+            cache_load (start, cnt);
+          start = sector;
+          cnt = sector != NO_SECTOR;
+        }
+    }
+  if (cnt > 1)
+    cache_load (start, cnt);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   Any number of readers may read INODE at once, but not while it
+   is being written. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t loaded = offset;
 
+  rwlock_acquire_read (&inode->rw);
+  if (inode->data.is_inline)
+    {
+      /* Copy straight out of the inode. */
+      if (size > 0 && offset < inode_length (inode))
+        {
+          bytes_read = inode_length (inode) - offset;
+          if (bytes_read > size)
+            bytes_read = size;
+          memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+        }
+      size = 0;
+    }
   while (size > 0) 
     {
+      /* Load the next several sectors in as few requests as
+         possible. */
+      if (offset >= loaded)
+        {
+          off_t load_size = LOAD_MAX * BLOCK_SECTOR_SIZE;
+          if (load_size > size)
+            load_size = size;
+          inode_load (inode, offset, load_size);
+          loaded = offset + load_size;
+        }
+
+
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,91 +518,166 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Copy the chunk out of the buffer cache, or zeros out of a
+         hole. */
+      if (sector_idx != NO_SECTOR)
+        cache_read_at (sector_idx, buffer + bytes_read, chunk_size,
+                       sector_ofs);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
+/* Asks the buffer cache to fetch, in the background, the sectors
+   that hold the SIZE bytes of INODE starting at OFFSET.  Bytes
+   past end of file are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  rwlock_acquire_read (&inode->rw);
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset, false);
+      if (sector != NO_SECTOR)
+        cache_read_ahead (sector);
+    }
+  rwlock_release_read (&inode->rw);
+}
+
+/* Writes SIZE bytes from BUFFER into inline INODE, starting at
+   OFFSET, which must leave the data within INLINE_MAX bytes.
+   Returns SIZE. */
+static off_t
+write_inline (struct inode *inode, const void *buffer, off_t size,
+              off_t offset)
+{
+  struct inode_disk *disk = &inode->data;
+
+  journal_begin ();
+  memcpy (disk->inline_data + offset, buffer, size);
+  if (offset + size > disk->length)
+    disk->length = offset + size;
+  journal_write (inode->sector, disk);
+  journal_end ();
+  return size;
+}
+
+/* Moves the data of inline INODE out to a newly allocated sector,
+   so that INODE can grow past INLINE_MAX bytes.  Returns true if
+   successful, false if the disk is full. */
+static bool
+move_inline_data (struct inode *inode)
+{
+  struct inode_disk *disk = &inode->data;
+  block_sector_t sector = NO_SECTOR;
+  bool is_dir = disk->is_dir != 0;
+
+  journal_begin ();
+  if (disk->length > 0)
+    {
+      if (!allocate_sector (&sector, is_dir))
+        {
+          journal_end ();
+          return false;
+        }
+      if (is_dir)
+        journal_write_at (sector, disk->inline_data, disk->length, 0);
+      else
+        {
+          cache_write_at (sector, disk->inline_data, disk->length, 0);
+          journal_order (sector);
+        }
+    }
+  memset (disk->inline_data, 0, sizeof disk->inline_data);
+  disk->direct[0] = sector;
+  disk->is_inline = 0;
+  journal_write (inode->sector, disk);
+  journal_end ();
+  return true;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or the maximum file size
+   is reached.  Writing past end of file extends the inode,
+   allocating sectors only for the parts that are written.
+   Writers have INODE to themselves. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_write (&inode->rw);
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      rwlock_release_write (&inode->rw);
+      return 0;
+    }
+
+  if (inode->data.is_inline && size > 0)
+    {
+      if (offset + size <= INLINE_MAX)
+        {
+          bytes_written = write_inline (inode, buffer, size, offset);
+          rwlock_release_write (&inode->rw);
+          return bytes_written;
+        }
+      if (!move_inline_data (inode))
+        {
+          rwlock_release_write (&inode->rw);
+          return 0;
+        }
+    }
 
   while (size > 0) 
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Sector to write, starting byte offset within sector.
+         Allocating it changes metadata, so it is an operation of
+         its own unless this write is part of one already. */
+      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
-
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+      if (sector_idx == NO_SECTOR)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          journal_begin ();
+          sector_idx = byte_to_sector (inode, offset, true);
+          journal_end ();
+          if (sector_idx == NO_SECTOR)
+            break;
         }
-      else 
+
+      /* Copy the chunk into the buffer cache, which reads in the
+         rest of the sector first if the chunk is partial.  A
+         directory's contents are metadata.  File data past the
+         end of file must reach the disk before the new length
+         commits. */
+      if (inode_is_dir (inode))
+        journal_write_at (sector_idx, buffer + bytes_written, chunk_size,
+                          sector_ofs);
+      else
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          cache_write_at (sector_idx, buffer + bytes_written, chunk_size,
+                          sector_ofs);
+          if (offset + chunk_size > inode->data.length)
+            journal_order (sector_idx);
         }
 
       /* Advance. */
@@ -312,7 +685,17 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file only once the data is in place, so that
+     readers never see unwritten bytes. */
+  if (offset > inode->data.length)
+    {
+      journal_begin ();
+      inode->data.length = offset;
+      journal_write (inode->sector, &inode->data);
+      journal_end ();
+    }
+  rwlock_release_write (&inode->rw);
 
   return bytes_written;
 }
@@ -322,8 +705,9 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
-  ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +716,41 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
-  ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rw);
+}
+
+/* Returns a hash value for the open inode in E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if open inode A precedes open inode B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  const struct inode *inode_a = hash_entry (a, struct inode, elem);
+  const struct inode *inode_b = hash_entry (b, struct inode, elem);
+  return inode_a->sector < inode_b->sector;
+}
+
+/* Returns the sector that holds byte offset POS within INODE, or
+   NO_SECTOR if none has been allocated. */
+block_sector_t
+inode_get_sector (struct inode *inode, off_t pos)
+{
+  block_sector_t sector;
+
+  rwlock_acquire_read (&inode->rw);
+  sector = byte_to_sector (inode, pos, false);
+  rwlock_release_read (&inode->rw);
+  return sector;
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -0,0 +1,737 @@
+#include "filesys/journal.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* The journal is a write-ahead log of file system metadata: the
+   free map, inodes, index blocks and directory contents.  It
+   lives in a contiguous log area allocated when the file system
+   is formatted, described by a header in JOURNAL_SECTOR.
+
+   Every operation that changes metadata runs between
+   journal_begin() and journal_end(), and writes metadata
+   through journal_write() instead of the buffer cache.  Such
+   sectors stay in the cache, out of write-back, until the
+   running transaction commits.  Every journal_commit_interval
+   ticks, the commit thread waits for running operations to
+   finish and commits everything they changed as one
+   transaction: a descriptor listing the sectors, their
+   contents, and then, once those are on disk, a commit block.
+   Only then may the sectors be written back to their homes, by
+   the cache's write-behind thread as usual.  A burst of
+   operations thus costs one sequential write to the log, plus
+   one small one for the commit block.
+
+   The free map is not logged through the cache: each commit
+   copies the changed sectors of the free map file straight from
+   memory.
+
+   When the log fills up, a checkpoint writes every dirty sector
+   back to its home and starts the log over.  Mounting replays
+   the committed transactions in the log, so recovery reads at
+   most the log, whatever the size of the disk.
+
+   File data is not logged, but a committed transaction must not
+   point an inode at a sector whose new contents never reached
+   the disk, or a crash would expose whatever the sector held
+   before.  So data sectors that the running transaction's
+   metadata refers to, newly allocated or newly inside a file's
+   length, are written back before the commit block.
+
+   Sectors that a transaction frees are not reused until it
+   commits, so that a crash never leaves the old metadata
+   pointing at a sector that something else has overwritten.
+   A sector freed after being logged may still be reused for file
+   data, which is not logged.  Replaying the old image would
+   then overwrite the data, so the transaction that frees such
+   a sector records a revocation, and replay skips images that a
+   revocation in the same or a later transaction covers. */
+
+/* Identifies the journal header and log blocks. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* A running transaction holds at most TXN_HARD sectors in the
+   cache.  Each top-level operation reserves credits for OP_MAX
+   sectors when it begins, and gives one back for each sector
+   that it adds to the transaction, along with whatever it has
+   left when it ends.  An operation begins only if the sectors
+   already in the transaction and the credits still reserved
+   leave room for its own; otherwise it waits for a commit.  An
+   operation that changes more than expected, such as rebuilding
+   a large directory, may take the transaction past TXN_HARD
+   sectors.  Past that, further sectors are written back without
+   being logged, and the transaction ends in a checkpoint instead
+   of being logged, so that the cache does not fill up with
+   sectors it cannot evict. */
+#define OP_MAX 8
+#define TXN_HARD 48
+
+/* Most data sectors that a transaction orders individually.
+   Past that, a commit writes back every dirty sector first. */
+#define ORDERED_MAX 64
+
+/* Number of the largest possible transactions that the log
+   holds. */
+#define LOG_TXN_CNT 4
+
+/* Number of sectors listed in a log block. */
+#define LOG_SECTOR_CNT 124
+
+/* Journal header, stored in JOURNAL_SECTOR.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    uint32_t magic;                     /* JOURNAL_MAGIC. */
+    block_sector_t start;               /* First sector of log. */
+    block_sector_t size;                /* Number of sectors in log. */
+    uint32_t seq;                       /* Sequence number of the
+                                           transaction at log start. */
+    uint8_t unused[496];                /* Not used. */
+  };
+
+/* Type of a log block. */
+enum log_type
+  {
+    LOG_DESCRIPTOR,                     /* Lists images that follow. */
+    LOG_REVOKE,                         /* Lists revoked sectors. */
+    LOG_COMMIT                          /* Ends a transaction. */
+  };
+
+/* A block in the log, other than a sector image.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct log_block
+  {
+    uint32_t magic;                     /* JOURNAL_MAGIC. */
+    uint32_t type;                      /* A log_type. */
+    uint32_t seq;                       /* Transaction sequence number. */
+    uint32_t cnt;                       /* Number of sectors listed, or
+                                           for LOG_COMMIT, of log blocks
+                                           before this one. */
+    block_sector_t sectors[LOG_SECTOR_CNT];     /* Sectors listed. */
+  };
+
+/* A sector revoked by a transaction, during replay. */
+struct revocation
+  {
+    block_sector_t sector;              /* Revoked sector. */
+    uint32_t seq;                       /* Revoking transaction. */
+  };
+
+int64_t journal_commit_interval = TIMER_FREQ / 20;
+
+static bool journal_active;             /* Logging metadata? */
+static struct journal_header header;    /* Copy of header on disk. */
+static block_sector_t log_head;         /* Next log sector to write,
+                                           relative to header.start. */
+static uint32_t next_seq;               /* Next transaction's number. */
+static size_t image_max;                /* Most images in a transaction. */
+static size_t txn_sector_max;           /* Most log sectors that a
+                                           transaction occupies. */
+
+/* Running transaction. */
+static struct lock journal_lock;        /* Protects the members below. */
+static struct condition journal_idle;   /* No operations in progress. */
+static struct condition commit_done;    /* A commit finished. */
+static bool committing;                 /* Commit in progress? */
+static int active_cnt;                  /* Operations in progress. */
+static size_t reserved_cnt;             /* Credits held by operations
+                                           in progress. */
+static block_sector_t txn_sectors[TXN_HARD];    /* Sectors changed. */
+static size_t txn_cnt;                  /* Number of txn_sectors. */
+static bool txn_overflow;               /* Exceeded TXN_HARD sectors? */
+static block_sector_t ordered[ORDERED_MAX];     /* Data sectors to
+                                                   write first. */
+static size_t ordered_cnt;              /* Number of ordered. */
+static bool ordered_overflow;           /* Exceeded ORDERED_MAX? */
+static struct bitmap *revoked;          /* Sectors revoked. */
+static size_t revoke_cnt;               /* Number of sectors revoked. */
+
+/* Sectors that have an image in the log, one bit per sector of
+   the file system device.  Owned by the committing thread. */
+static struct bitmap *logged;
+
+/* Buffers for committing and replaying, owned by the committing
+   thread. */
+static uint8_t (*images)[BLOCK_SECTOR_SIZE];   /* Sector images. */
+static block_sector_t *image_sectors;   /* Home of each image. */
+static struct log_block *log_blocks;    /* Descriptors and so on. */
+static block_sector_t sync_sectors[ORDERED_MAX];        /* Data sectors
+                                                   to write back. */
+static const void **log_buffers;        /* One transaction, in order. */
+
+/* Revocations found during replay. */
+static struct revocation *revocations;
+static size_t revocation_cnt;
+
+/* Statistics. */
+static long long commit_cnt;            /* Transactions logged. */
+static long long logged_cnt;            /* Sector images logged. */
+static long long checkpoint_cnt;        /* Checkpoints. */
+
+static void commit (bool final);
+static void write_log (size_t image_cnt);
+static void checkpoint (void);
+static bool replay_txn (block_sector_t *pos, uint32_t seq, bool apply);
+static thread_func commit_daemon NO_RETURN;
+
+/* Initializes the journal module.  Call this after
+   free_map_init(). */
+void
+journal_init (void)
+{
+  size_t log_block_cnt, page_cnt;
+
+  image_max = TXN_HARD + free_map_sector_cnt ();
+  log_block_cnt = DIV_ROUND_UP (image_max, LOG_SECTOR_CNT) + 2;
+  txn_sector_max = image_max + log_block_cnt;
+
+  page_cnt = DIV_ROUND_UP (image_max * BLOCK_SECTOR_SIZE, PGSIZE);
+  images = palloc_get_multiple (PAL_ASSERT, page_cnt);
+  image_sectors = malloc (image_max * sizeof *image_sectors);
+  log_blocks = malloc (log_block_cnt * sizeof *log_blocks);
+  log_buffers = malloc (txn_sector_max * sizeof *log_buffers);
+  revoked = bitmap_create (block_size (fs_device));
+  logged = bitmap_create (block_size (fs_device));
+  if (image_sectors == NULL || log_blocks == NULL || log_buffers == NULL
+      || revoked == NULL || logged == NULL)
+    PANIC ("out of memory allocating journal");
+
+  lock_init (&journal_lock);
+  cond_init (&journal_idle);
+  cond_init (&commit_done);
+}
+
+/* Creates the journal on a newly formatted file system: allocates
+   the log from the free map, erases it and writes the journal
+   header.  The journal does not run until journal_open(). */
+void
+journal_create (void)
+{
+  size_t i;
+
+  memset (&header, 0, sizeof header);
+  header.magic = JOURNAL_MAGIC;
+  header.size = LOG_TXN_CNT * txn_sector_max;
+  header.seq = 1;
+  if (!free_map_allocate (header.size, &header.start))
+    PANIC ("file system device too small for %"PRDSNu"-sector journal",
+           header.size);
+
+  /* Erase the log, so that nothing left on the disk from an
+     earlier file system can pass for a transaction. */
+  memset (images[0], 0, BLOCK_SECTOR_SIZE);
+  for (i = 0; i < txn_sector_max; i++)
+    log_buffers[i] = images[0];
+  for (i = 0; i < header.size; i += txn_sector_max)
+    block_write_multi (fs_device, header.start + i, txn_sector_max,
+                       log_buffers);
+
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/* Reads the journal header and replays every committed
+   transaction in the log, then writes back their sectors and
+   empties the log.  Call this before reading anything else from
+   the file system. */
+void
+journal_recover (void)
+{
+  block_sector_t pos;
+  uint32_t seq;
+
+  block_read (fs_device, JOURNAL_SECTOR, &header);
+  if (header.magic != JOURNAL_MAGIC)
+    PANIC ("file system has no journal (reformat with -f)");
+  if (header.size < txn_sector_max)
+    PANIC ("journal too small (%"PRDSNu" sectors)", header.size);
+
+  /* Find the committed transactions and collect their
+     revocations, then apply their images. */
+  revocation_cnt = 0;
+  pos = 0;
+  for (seq = header.seq; replay_txn (&pos, seq, false); seq++)
+    continue;
+  pos = 0;
+  for (seq = header.seq; replay_txn (&pos, seq, true); seq++)
+    continue;
+  free (revocations);
+  revocations = NULL;
+
+  if (seq != header.seq)
+    {
+      printf ("journal: replayed %u transactions\n",
+              (unsigned) (seq - header.seq));
+      cache_flush ();
+      header.seq = seq;
+      block_write (fs_device, JOURNAL_SECTOR, &header);
+    }
+  next_seq = header.seq;
+  log_head = 0;
+}
+
+/* Starts logging metadata changes and the thread that commits
+   them.  Call this once the file system is otherwise ready. */
+void
+journal_open (void)
+{
+  journal_active = true;
+  thread_create ("journal", PRI_DEFAULT, commit_daemon, NULL);
+}
+
+/* Commits the running transaction, writes every dirty sector
+   back and empties the log, so that the next mount has nothing
+   to replay.  Metadata is not logged afterward. */
+void
+journal_done (void)
+{
+  commit (true);
+}
+
+/* Begins an operation that changes metadata.  Until the matching
+   journal_end(), every change that the operation makes through
+   journal_write() is part of the same transaction.  Operations
+   nest; only the outermost one may wait for a commit to make
+   room, so it must not be called with file system locks held
+   that an operation in progress might need. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  for (;;)
+    {
+      if (committing)
+        cond_wait (&commit_done, &journal_lock);
+      else if (journal_active
+               && txn_cnt + reserved_cnt + OP_MAX > TXN_HARD)
+        {
+          lock_release (&journal_lock);
+          journal_commit ();
+          lock_acquire (&journal_lock);
+        }
+      else
+        break;
+    }
+  active_cnt++;
+  if (journal_active)
+    {
+      t->journal_credits = OP_MAX;
+      reserved_cnt += OP_MAX;
+    }
+  lock_release (&journal_lock);
+}
+
+/* Ends an operation begun with journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  reserved_cnt -= t->journal_credits;
+  t->journal_credits = 0;
+  if (--active_cnt == 0)
+    cond_broadcast (&journal_idle, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes of metadata from BUFFER to
+   sector SECTOR as part of the running transaction. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  journal_write_at (sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Writes SIZE bytes of metadata from BUFFER starting at byte
+   OFFSET within sector SECTOR as part of the running
+   transaction.  Must be called between journal_begin() and
+   journal_end(). */
+void
+journal_write_at (block_sector_t sector, const void *buffer, off_t size,
+                  off_t offset)
+{
+  struct thread *t = thread_current ();
+  bool journaled;
+  size_t i;
+
+  if (!journal_active)
+    {
+      cache_write_at (sector, buffer, size, offset);
+      return;
+    }
+  ASSERT (t->journal_depth > 0);
+
+  lock_acquire (&journal_lock);
+  for (i = 0; i < txn_cnt; i++)
+    if (txn_sectors[i] == sector)
+      break;
+  if (i == txn_cnt)
+    {
+      if (txn_cnt < TXN_HARD)
+        txn_sectors[txn_cnt++] = sector;
+      else
+        txn_overflow = true;
+      if (t->journal_credits > 0)
+        {
+          t->journal_credits--;
+          reserved_cnt--;
+        }
+    }
+  journaled = i < txn_cnt;
+
+  /* Metadata again, so its new image supersedes the
+     revocation. */
+  if (bitmap_test (revoked, sector))
+    {
+      bitmap_reset (revoked, sector);
+      revoke_cnt--;
+    }
+  lock_release (&journal_lock);
+
+  if (journaled)
+    cache_write_journaled_at (sector, buffer, size, offset);
+  else
+    cache_write_at (sector, buffer, size, offset);
+}
+
+/* Notes that the CNT sectors starting at SECTOR have been freed,
+   so that no older image of them is replayed over whatever they
+   are reused for.  Returns true if the sectors must not be
+   reused until the running transaction commits, which the
+   journal then reports through free_map_commit(). */
+bool
+journal_release (block_sector_t sector, size_t cnt)
+{
+  block_sector_t end = sector + cnt;
+
+  if (!journal_active)
+    return false;
+
+  lock_acquire (&journal_lock);
+  for (; sector < end; sector++)
+    {
+      bool in_txn = false;
+      size_t i;
+
+      if (bitmap_test (revoked, sector))
+        continue;
+      for (i = 0; i < txn_cnt && !in_txn; i++)
+        in_txn = txn_sectors[i] == sector;
+      if (in_txn || bitmap_test (logged, sector))
+        {
+          bitmap_mark (revoked, sector);
+          revoke_cnt++;
+        }
+    }
+  lock_release (&journal_lock);
+  return true;
+}
+
+/* Notes that SECTOR holds file data that metadata in the running
+   transaction refers to, or is about to, so that the data
+   reaches the disk before the transaction commits.  Call this
+   after writing the data to the cache. */
+void
+journal_order (block_sector_t sector)
+{
+  size_t i;
+
+  if (!journal_active)
+    return;
+
+  lock_acquire (&journal_lock);
+  for (i = ordered_cnt; i > 0; i--)
+    if (ordered[i - 1] == sector)
+      break;
+  if (i == 0)
+    {
+      if (ordered_cnt < ORDERED_MAX)
+        ordered[ordered_cnt++] = sector;
+      else
+        ordered_overflow = true;
+    }
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction, waiting for operations in
+   progress to finish first. */
+void
+journal_commit (void)
+{
+  commit (false);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %lld commits, %lld sectors logged, %lld checkpoints\n",
+          commit_cnt, logged_cnt, checkpoint_cnt);
+}
+
+/* Commits the running transaction, as described at the top of
+   the file.  If FINAL is true, also checkpoints and stops
+   logging. */
+static void
+commit (bool final)
+{
+  size_t image_cnt, fm_cnt, sync_cnt, i;
+  bool sync_all;
+
+  lock_acquire (&journal_lock);
+  while (committing)
+    cond_wait (&commit_done, &journal_lock);
+  if (!journal_active)
+    {
+      lock_release (&journal_lock);
+      return;
+    }
+  committing = true;
+  while (active_cnt > 0)
+    cond_wait (&journal_idle, &journal_lock);
+
+  /* Data ordered from now on belongs to the next transaction. */
+  sync_cnt = ordered_cnt;
+  sync_all = ordered_overflow;
+  memcpy (sync_sectors, ordered, sync_cnt * sizeof *ordered);
+  ordered_cnt = 0;
+  ordered_overflow = false;
+  lock_release (&journal_lock);
+
+  /* Write back the data that the transaction refers to.  Sectors
+     journaled meanwhile are metadata now and are skipped. */
+  if (sync_all)
+    cache_flush ();
+  else if (sync_cnt > 0)
+    cache_sync (sync_sectors, sync_cnt);
+
+  /* Gather the images: sectors from the cache, then the free
+     map. */
+  for (i = 0; i < txn_cnt; i++)
+    {
+      image_sectors[i] = txn_sectors[i];
+      cache_read (txn_sectors[i], images[i]);
+    }
+  fm_cnt = free_map_collect (image_sectors + txn_cnt, images + txn_cnt);
+  image_cnt = txn_cnt + fm_cnt;
+
+  if (!txn_overflow && revoke_cnt <= LOG_SECTOR_CNT
+      && (image_cnt > 0 || revoke_cnt > 0))
+    write_log (image_cnt);
+
+  /* The transaction is durable, or about to be made so by a
+     checkpoint, so its sectors may go home. */
+  for (i = 0; i < txn_cnt; i++)
+    cache_commit (txn_sectors[i]);
+  for (i = txn_cnt; i < image_cnt; i++)
+    cache_write (image_sectors[i], images[i]);
+
+  if (final || txn_overflow || revoke_cnt > LOG_SECTOR_CNT
+      || header.size - log_head < txn_sector_max)
+    checkpoint ();
+
+  /* Sectors that the transaction freed may now be reused. */
+  free_map_commit ();
+
+  lock_acquire (&journal_lock);
+  txn_cnt = 0;
+  txn_overflow = false;
+  if (revoke_cnt > 0)
+    {
+      bitmap_set_all (revoked, false);
+      revoke_cnt = 0;
+    }
+  if (final)
+    journal_active = false;
+  committing = false;
+  cond_broadcast (&commit_done, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Returns log block I, initialized with TYPE for the next
+   transaction. */
+static struct log_block *
+new_log_block (size_t i, enum log_type type)
+{
+  struct log_block *b = &log_blocks[i];
+
+  memset (b, 0, sizeof *b);
+  b->magic = JOURNAL_MAGIC;
+  b->type = type;
+  b->seq = next_seq;
+  return b;
+}
+
+/* Writes the running transaction, whose IMAGE_CNT images are in
+   images[] and image_sectors[], to the log at log_head. */
+static void
+write_log (size_t image_cnt)
+{
+  struct log_block *b = NULL;
+  size_t block_cnt = 0;
+  size_t n = 0;
+  size_t i;
+
+  for (i = 0; i < image_cnt; i++)
+    {
+      if (i % LOG_SECTOR_CNT == 0)
+        {
+          b = new_log_block (block_cnt++, LOG_DESCRIPTOR);
+          log_buffers[n++] = b;
+        }
+      b->sectors[b->cnt++] = image_sectors[i];
+      log_buffers[n++] = images[i];
+      bitmap_mark (logged, image_sectors[i]);
+    }
+  if (revoke_cnt > 0)
+    {
+      size_t sector;
+
+      b = new_log_block (block_cnt++, LOG_REVOKE);
+      for (sector = bitmap_scan (revoked, 0, 1, true);
+           sector != BITMAP_ERROR;
+           sector = bitmap_scan (revoked, sector + 1, 1, true))
+        b->sectors[b->cnt++] = sector;
+      log_buffers[n++] = b;
+    }
+  ASSERT (log_head + n + 1 <= header.size);
+
+  /* The commit block goes out only once everything before it is
+     on disk, so that a torn transaction is never replayed. */
+  block_write_multi (fs_device, header.start + log_head, n, log_buffers);
+  b = new_log_block (block_cnt, LOG_COMMIT);
+  b->cnt = n;
+  block_write (fs_device, header.start + log_head + n, b);
+
+  log_head += n + 1;
+  next_seq++;
+  commit_cnt++;
+  logged_cnt += image_cnt;
+}
+
+/* Writes every dirty sector back to its home, then empties the
+   log.  Must be called with no sector journaled. */
+static void
+checkpoint (void)
+{
+  cache_flush ();
+  header.seq = next_seq;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+  log_head = 0;
+  bitmap_set_all (logged, false);
+  checkpoint_cnt++;
+}
+
+/* Returns true if a revocation found during replay covers the
+   image of SECTOR in transaction SEQ. */
+static bool
+is_revoked (block_sector_t sector, uint32_t seq)
+{
+  size_t i;
+
+  for (i = 0; i < revocation_cnt; i++)
+    if (revocations[i].sector == sector && revocations[i].seq >= seq)
+      return true;
+  return false;
+}
+
+/* Reads the transaction numbered SEQ from log sector *POS.  If it
+   is committed, advances *POS past it and returns true;
+   otherwise returns false.  If APPLY is false, collects the
+   transaction's revocations; if it is true, writes its images
+   that are not revoked to their homes through the cache. */
+static bool
+replay_txn (block_sector_t *pos, uint32_t seq, bool apply)
+{
+  struct log_block *b = &log_blocks[0];
+  size_t first_revocation = revocation_cnt;
+  block_sector_t p = *pos;
+
+  while (p < header.size)
+    {
+      size_t i;
+
+      block_read (fs_device, header.start + p, b);
+      if (b->magic != JOURNAL_MAGIC || b->seq != seq
+          || b->cnt > LOG_SECTOR_CNT)
+        break;
+
+      if (b->type == LOG_COMMIT)
+        {
+          *pos = p + 1;
+          return true;
+        }
+      else if (b->type == LOG_DESCRIPTOR)
+        {
+          if (p + 1 + b->cnt > header.size)
+            break;
+          if (apply)
+            for (i = 0; i < b->cnt; i++)
+              if (!is_revoked (b->sectors[i], seq))
+                {
+                  block_read (fs_device, header.start + p + 1 + i, images[0]);
+                  cache_write (b->sectors[i], images[0]);
+                }
+          p += 1 + b->cnt;
+        }
+      else if (b->type == LOG_REVOKE)
+        {
+          if (!apply)
+            {
+              struct revocation *r;
+
+              r = realloc (revocations,
+                           (revocation_cnt + b->cnt) * sizeof *r);
+              if (r == NULL)
+                PANIC ("out of memory replaying journal");
+              revocations = r;
+              for (i = 0; i < b->cnt; i++)
+                {
+                  r[revocation_cnt].sector = b->sectors[i];
+                  r[revocation_cnt].seq = seq;
+                  revocation_cnt++;
+                }
+            }
+          p++;
+        }
+      else
+        break;
+    }
+
+  /* Not committed: forget its revocations. */
+  revocation_cnt = first_revocation;
+  return false;
+}
+
+/* Commit thread.  Commits the running transaction every
+   journal_commit_interval ticks, so that operations in between
+   share one write to the log. */
+static void
+commit_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (journal_commit_interval);
+      journal_commit ();
+    }
+}
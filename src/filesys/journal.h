@@ -0,0 +1,31 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Timer ticks between group commits.
+   Controlled by kernel command-line option "-jc=TICKS". */
+extern int64_t journal_commit_interval;
+
+void journal_init (void);
+void journal_create (void);
+void journal_recover (void);
+void journal_open (void);
+void journal_done (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_write (block_sector_t, const void *);
+void journal_write_at (block_sector_t, const void *, off_t size,
+                       off_t offset);
+bool journal_release (block_sector_t, size_t cnt);
+void journal_order (block_sector_t);
+void journal_commit (void);
+
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,53 @@
+/* Child process for syn-contend test.
+   Reads the contents of a test file a block at a time, reopening
+   it and checking its size between passes, so that file opens
+   and metadata queries contend with other children's reads. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/syn-contend.h"
+
+const char *test_name = "child-syn-contend";
+
+#define PASS_CNT 4
+
+static char buf[BUF_SIZE];
+static char block[BLOCK_SIZE];
+
+int
+main (int argc, const char *argv[]) 
+{
+  int child_idx;
+  int pass;
+
+  quiet = true;
+  
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  for (pass = 0; pass < PASS_CNT; pass++)
+    {
+      size_t ofs;
+      int fd;
+
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      CHECK (filesize (fd) == (int) sizeof buf,
+             "filesize \"%s\"", file_name);
+      for (ofs = 0; ofs < sizeof buf; ofs += sizeof block)
+        {
+          seek (fd, ofs);
+          CHECK (read (fd, block, sizeof block) == (int) sizeof block,
+                 "read \"%s\"", file_name);
+          compare_bytes (block, buf + ofs, sizeof block, ofs, file_name);
+        }
+      close (fd);
+    }
+
+  return child_idx;
+}
@@ -0,0 +1,72 @@
+/* Creates FILE_CNT files, then opens each of them OPEN_CNT
+   times, so that the kernel must keep thousands of files open
+   at once and look up an already-open inode on almost every
+   open.  Reads the first byte of each file through every
+   descriptor to make sure that each one refers to the right
+   file.
+
+   The checked output covers only correctness.  To compare the
+   cost of the opens against a list of open inodes, run the test
+   against both and compare the "Timer: N ticks" line that the
+   kernel prints at power-off. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 128
+#define OPEN_CNT 16
+
+static int fds[FILE_CNT][OPEN_CNT];
+
+void
+test_main (void) 
+{
+  char name[16];
+  int i, j;
+
+  msg ("creating %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      char byte = i;
+      int fd;
+
+      snprintf (name, sizeof name, "file%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+      fd = open (name);
+      if (fd < 2)
+        fail ("open \"%s\" failed", name);
+      if (write (fd, &byte, 1) != 1)
+        fail ("write \"%s\" failed", name);
+      close (fd);
+    }
+
+  msg ("opening each file %d times", OPEN_CNT);
+  for (j = 0; j < OPEN_CNT; j++)
+    for (i = 0; i < FILE_CNT; i++)
+      {
+        snprintf (name, sizeof name, "file%d", i);
+        fds[i][j] = open (name);
+        if (fds[i][j] < 2)
+          fail ("open \"%s\" failed", name);
+      }
+
+  msg ("reading through every descriptor");
+  for (i = 0; i < FILE_CNT; i++)
+    for (j = 0; j < OPEN_CNT; j++)
+      {
+        char byte;
+
+        if (read (fds[i][j], &byte, 1) != 1)
+          fail ("read \"file%d\" failed", i);
+        if (byte != (char) i)
+          fail ("\"file%d\" read %d instead of %d", i, byte, i);
+      }
+
+  msg ("closing all descriptors");
+  for (i = 0; i < FILE_CNT; i++)
+    for (j = 0; j < OPEN_CNT; j++)
+      close (fds[i][j]);
+}
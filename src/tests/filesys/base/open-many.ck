@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(open-many) begin
+(open-many) creating 128 files
+(open-many) opening each file 16 times
+(open-many) reading through every descriptor
+(open-many) closing all descriptors
+(open-many) end
+EOF
+pass;
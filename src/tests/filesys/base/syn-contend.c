@@ -0,0 +1,41 @@
+/* Spawns rounds of 1, 2, 4 and 8 child processes that all read
+   the same file at once, a block at a time, and make sure that
+   the contents are what they should be.
+
+   User programs have no clock to read, and the output must match
+   syn-contend.ck exactly, so the rounds are not timed here;
+   the point is that readers of one file, which now share its
+   lock, never see each other's partial results. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/base/syn-contend.h"
+
+static char buf[BUF_SIZE];
+
+#define MAX_READERS 8
+
+void
+test_main (void) 
+{
+  pid_t children[MAX_READERS];
+  size_t reader_cnt;
+  int fd;
+
+  CHECK (create (file_name, sizeof buf), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  random_bytes (buf, sizeof buf);
+  CHECK (write (fd, buf, sizeof buf) > 0, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  for (reader_cnt = 1; reader_cnt <= MAX_READERS; reader_cnt *= 2)
+    {
+      msg ("%zu concurrent readers", reader_cnt);
+      exec_children ("child-syn-contend", children, reader_cnt);
+      wait_children (children, reader_cnt);
+    }
+}
@@ -0,0 +1,8 @@
+#ifndef TESTS_FILESYS_BASE_SYN_CONTEND_H
+#define TESTS_FILESYS_BASE_SYN_CONTEND_H
+
+#define BLOCK_SIZE 512
+#define BUF_SIZE (32 * BLOCK_SIZE)
+static const char file_name[] = "data";
+
+#endif /* tests/filesys/base/syn-contend.h */
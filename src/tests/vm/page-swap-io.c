@@ -0,0 +1,67 @@
+/* Runs 2 child-linear processes, which page heavily, while
+   writing a file and reading it back, so that swap and file
+   system I/O are in flight at the same time. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 2
+#define FILE_SIZE (256 * 1024)
+#define CHUNK_SIZE 4096
+
+static char expected[CHUNK_SIZE];
+static char actual[CHUNK_SIZE];
+
+/* Fills expected[] with the next chunk of ARC4's keystream. */
+static void
+next_chunk (struct arc4 *arc4)
+{
+  memset (expected, 0, sizeof expected);
+  arc4_crypt (arc4, expected, sizeof expected);
+}
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  struct arc4 arc4;
+  size_t ofs;
+  int fd;
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK ((children[i] = exec ("child-linear")) != -1,
+           "exec \"child-linear\"");
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+
+  msg ("write \"data\"");
+  arc4_init (&arc4, "page-swap-io", 12);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    {
+      next_chunk (&arc4);
+      if (write (fd, expected, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("write %d bytes at offset %zu failed", CHUNK_SIZE, ofs);
+    }
+
+  msg ("read \"data\"");
+  seek (fd, 0);
+  arc4_init (&arc4, "page-swap-io", 12);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    {
+      next_chunk (&arc4);
+      if (read (fd, actual, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("read %d bytes at offset %zu failed", CHUNK_SIZE, ofs);
+      if (memcmp (actual, expected, CHUNK_SIZE))
+        fail ("data read at offset %zu differs from data written", ofs);
+    }
+  msg ("close \"data\"");
+  close (fd);
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK (wait (children[i]) == 0x42, "wait for child %d", i);
+}
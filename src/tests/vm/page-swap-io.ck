@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-swap-io) begin
+(page-swap-io) exec "child-linear"
+(page-swap-io) exec "child-linear"
+(page-swap-io) create "data"
+(page-swap-io) open "data"
+(page-swap-io) write "data"
+(page-swap-io) read "data"
+(page-swap-io) close "data"
+(page-swap-io) wait for child 0
+(page-swap-io) wait for child 1
+(page-swap-io) end
+pass;
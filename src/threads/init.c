@@ -32,10 +32,20 @@
 #include "tests/threads/tests.h"
 #endif
 #ifdef FILESYS
+#include "devices/ahci.h"
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
+#include "devices/virtio-blk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/journal.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -124,10 +134,17 @@ main (void)
 
 #ifdef FILESYS
   /* Initialize file system. */
+  ramdisk_init ();
   ide_init ();
+  virtio_blk_init ();
+  ahci_init ();
+  stripe_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
+#ifdef VM
+  swap_init ();
+#endif
 
   printf ("Boot complete.\n");
   
@@ -249,6 +266,30 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ra"))
+        cache_readahead_window = atoi (value);
+      else if (!strcmp (name, "-wb"))
+        {
+          cache_flush_interval = atoi (value);
+          if (cache_flush_interval <= 0)
+            PANIC ("-wb interval must be at least 1 tick");
+        }
+      else if (!strcmp (name, "-jc"))
+        {
+          journal_commit_interval = atoi (value);
+          if (journal_commit_interval <= 0)
+            PANIC ("-jc interval must be at least 1 tick");
+        }
+      else if (!strcmp (name, "-pio"))
+        ide_pio_only = true;
+      else if (!strcmp (name, "-rdfs"))
+        ramdisk_filesys_kb = atoi (value);
+      else if (!strcmp (name, "-rdscratch"))
+        ramdisk_scratch_kb = atoi (value);
+      else if (!strcmp (name, "-stripe"))
+        stripe_members = value;
+      else if (!strcmp (name, "-stripe-size"))
+        stripe_sectors = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -375,6 +416,14 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ra=SECTORS        Read SECTORS ahead of sequential readers.\n"
+          "  -wb=TICKS          Write dirty sectors back every TICKS ticks.\n"
+          "  -jc=TICKS          Commit metadata journal every TICKS ticks.\n"
+          "  -pio               Move disk data by PIO, never by DMA.\n"
+          "  -rdfs=KB           Use a KB kB RAM disk for file system.\n"
+          "  -rdscratch=KB      Use a KB kB RAM disk for scratch.\n"
+          "  -stripe=BDEV,...   Stripe BDEVs together for file system.\n"
+          "  -stripe-size=N     Use N-sector stripe units (default 8).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -393,6 +442,11 @@ usage (void)
 static void
 locate_block_devices (void)
 {
+  /* A striped array exists only to hold the file system, so it
+     takes that role unless -filesys named another device. */
+  if (filesys_bdev_name == NULL && stripe_members != NULL)
+    filesys_bdev_name = STRIPE_NAME;
+
   locate_block_device (BLOCK_FILESYS, filesys_bdev_name);
   locate_block_device (BLOCK_SCRATCH, scratch_bdev_name);
 #ifdef VM
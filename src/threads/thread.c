@@ -17,6 +17,9 @@
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
+#ifdef FILESYS
+#include "filesys/directory.h"
+#endif
 
 /* Random value for struct thread's `magic' member.
    Used to detect stack overflow.  See the big comment at the top
@@ -254,6 +257,13 @@ thread_create (const char *name, int priority,
   sf->eip = switch_entry;
   sf->ebp = 0;
 
+#ifdef FILESYS
+  /* Inherit the working directory.  This must happen before the
+     new thread can run and look up a path. */
+  if (thread_current ()->cwd != NULL)
+    t->cwd = dir_reopen (thread_current ()->cwd);
+#endif
+
   /* Add to run queue. */
   thread_unblock (t);
 
@@ -382,6 +392,13 @@ thread_exit (void)
   process_exit ();
 #endif
 
+#ifdef FILESYS
+  /* Release the working directory, which every thread inherits
+     from its creator. */
+  dir_close (thread_current ()->cwd);
+  thread_current ()->cwd = NULL;
+#endif
+
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
@@ -725,6 +742,7 @@ init_thread (struct thread *t, const char *name, int priority)
     }
 
   list_init (&t->children);
+  list_init (&t->mappings);
   list_init (&t->lock_list);
   t->blocking_lock = NULL;
   old_level = intr_disable ();
@@ -8,6 +8,8 @@
 #include "threads/synch.h"
 #include "lib/kernel/hash.h"
 
+struct dir;
+
 /* States in a thread's life cycle. */
 enum thread_status
   {
@@ -126,6 +128,21 @@ struct thread
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
     struct hash h;                     /* Supplemental page table. */
+
+    /* Owned by vm/mmap.c. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Id of the next mapping. */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/filesys.c. */
+    struct dir *cwd;                    /* Working directory, or NULL
+                                         * for the root directory. */
+
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of journal_begin(). */
+    size_t journal_credits;             /* Sectors reserved by the
+                                         * outermost journal_begin(). */
 #endif
 
     /* Owned by thread.c. */
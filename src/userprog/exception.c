@@ -5,6 +5,7 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "vm/page.h"
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -152,8 +153,8 @@ page_fault (struct intr_frame *f)
 
   /* Handle page fault by loading page into memory */
   void *upage = pg_round_down (fault_addr);
-  bool success = page_handle_fault (&thread_current ()->h, upage);
-  if (success) {
+  if (not_present && is_user_vaddr (fault_addr)
+      && page_handle_fault (&thread_current ()->h, upage)) {
     return;
   }
 
@@ -20,6 +20,7 @@
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
 #include "vm/frame.h"
+#include "vm/mmap.h"
 #include "vm/page.h"
 
 #define FILENAME_MAX_LEN 14
@@ -189,7 +190,7 @@ process_exit (void)
       free (cs);
     }
 
-  /* Close all open files, including the executable, and free 
+  /* Close all open files and free 
    * the fd table. */
   size_t i;
   for (i = 0; i <= cur->fd_table_tail_idx; i++)
@@ -200,7 +201,11 @@ process_exit (void)
       }
     }
   free (cur->fd_table);
-  file_close (cur->executable);
+
+  /* Write back and remove file mappings while the page directory
+     still holds their dirty bits. */
+  if (cur->pagedir != NULL)
+    mmap_unmap_all ();
 
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
@@ -216,8 +221,14 @@ process_exit (void)
          that's been freed (and cleared). */
       cur->pagedir = NULL;
       pagedir_activate (NULL);
+      frame_free_all (pd);
       pagedir_destroy (pd);
+      page_table_destroy (&cur->h);
     }
+
+  /* Close the executable only now that no frame can still be
+     shared under its inode. */
+  file_close (cur->executable);
 }
 
 /* Sets up the CPU for running user code in the current
@@ -427,8 +438,6 @@ load (const char *file_name, void (**eip) (void), void **esp, void *aux)
 
 /* load() helpers. */
 
-static bool install_page (void *upage, void *kpage, bool writable);
-
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
 static bool
@@ -486,8 +495,11 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   Nothing is read here: each page is entered in the supplemental
+   page table and read from FILE the first time it is touched.
+
    Return true if successful, false if a memory allocation error
-   or disk read error occurs. */
+   occurs or UPAGE overlaps a page that is already loaded. */
 static bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
               uint32_t read_bytes, uint32_t zero_bytes, bool writable) 
@@ -496,7 +508,6 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
       /* Calculate how to fill this page.
@@ -504,30 +515,18 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
          and zero the final PAGE_ZERO_BYTES bytes. */
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      /* Get a page of memory. */
-      uint8_t *kpage = frame_alloc ();
-      if (kpage == NULL)
-        return false;
-
-      /* Load this page. */
-      if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes)
-        {
-          frame_free (kpage);
-          return false; 
-        }
-      memset (kpage + page_read_bytes, 0, page_zero_bytes);
+      struct hash *h = &thread_current ()->h;
 
       /* Add the page to the process's address space. */
-      if (!install_page (upage, kpage, writable)) 
-        {
-          frame_free (kpage);
-          return false; 
-        }
+      if (page_read_bytes > 0
+          ? !page_alloc_file (h, upage, file, ofs, page_read_bytes, writable)
+          : !page_alloc (h, upage, writable))
+        return false;
 
       /* Advance. */
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
       upage += PGSIZE;
     }
   return true;
@@ -605,23 +604,3 @@ setup_stack (void **esp, const char *aux)
 
   return success;
 }
-
-/* Adds a mapping from user virtual address UPAGE to kernel
-   virtual address KPAGE to the page table.
-   If WRITABLE is true, the user process may modify the page;
-   otherwise, it is read-only.
-   UPAGE must not already be mapped.
-   KPAGE should probably be a page obtained from the user pool
-   with palloc_get_page().
-   Returns true on success, false if UPAGE is already mapped or
-   if memory allocation fails. */
-static bool
-install_page (void *upage, void *kpage, bool writable)
-{
-  struct thread *t = thread_current ();
-
-  /* Verify that there's not already a page at that virtual
-     address, then map our page there. */
-  return (pagedir_get_page (t->pagedir, upage) == NULL
-          && pagedir_set_page (t->pagedir, upage, kpage, writable));
-}
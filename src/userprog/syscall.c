@@ -1,16 +1,21 @@
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "devices/shutdown.h"
 #include "devices/input.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "userprog/fdtable.h"
 #include "userprog/pagedir.h"
 #include "userprog/process.h"
 #include "userprog/syscall.h"
 #include "threads/interrupt.h"
-#include "threads/synch.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
 #include "lib/user/syscall.h"
 
 /* A table mapping syscall numbers to the number of arguments
@@ -19,8 +24,6 @@
 static uint8_t syscall_arg_num[] =
   {0, 1, 1, 1, 2, 1, 1, 1, 3, 3, 2, 1, 1, 2, 1, 1, 1, 2, 1, 1};
 
-struct lock filesys_lock;
-
 static void syscall_handler (struct intr_frame *f);
 static void sys_halt (void) NO_RETURN;
 static void sys_exit (struct intr_frame *f, int status) NO_RETURN;
@@ -38,11 +41,17 @@ static void sys_write (struct intr_frame *f, int fd, const void *buffer,
 static void sys_seek (struct intr_frame *f, int fd, unsigned position);
 static void sys_tell (struct intr_frame *f, int fd);
 static void sys_close (struct intr_frame *f, int fd);
+static void sys_mmap (struct intr_frame *f, int fd, void *addr);
+static void sys_munmap (struct intr_frame *f, mapid_t mapping);
+static void sys_chdir (struct intr_frame *f, const char *dir);
+static void sys_mkdir (struct intr_frame *f, const char *dir);
+static void sys_readdir (struct intr_frame *f, int fd, char *name);
+static void sys_isdir (struct intr_frame *f, int fd);
+static void sys_inumber (struct intr_frame *f, int fd);
 static bool is_valid_ptr (const void *ptr);
 static bool is_valid_range (const void *ptr, size_t len);
 static bool is_valid_string (const char *ptr);
 static inline void exit_on (struct intr_frame *f, bool condition);
-static inline void exit_on_file (struct intr_frame *f, bool condition);
 
 /* A convenience function for exiting gracefully from
    errors in system calls. The supplied condition should be
@@ -59,26 +68,10 @@ exit_on (struct intr_frame *f, bool condition)
   }
 }
 
-/* Similar to exit_on, but assumes that the filesystem
-   lock is held before invoked. If the supplied condition
-   is true, the lock is released and the thread is forced
-   to exit as per exit_on. */
-inline void
-exit_on_file (struct intr_frame *f, bool condition)
-{
-  ASSERT (lock_held_by_current_thread (&filesys_lock));
-  if (condition)
-  {
-    lock_release (&filesys_lock);
-    exit_on (f, true);
-  }
-}
-
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init (&filesys_lock);
 }
 
 static void
@@ -142,13 +135,27 @@ syscall_handler (struct intr_frame *f UNUSED)
       case SYS_CLOSE:
         sys_close (f, (int)args[0]);
         break;
-      case SYS_MMAP:
-      case SYS_MUNMAP:
       case SYS_CHDIR:
+        sys_chdir (f, (const char *)args[0]);
+        break;
       case SYS_MKDIR:
+        sys_mkdir (f, (const char *)args[0]);
+        break;
       case SYS_READDIR:
+        sys_readdir (f, (int)args[0], (char *)args[1]);
+        break;
       case SYS_ISDIR:
+        sys_isdir (f, (int)args[0]);
+        break;
       case SYS_INUMBER:
+        sys_inumber (f, (int)args[0]);
+        break;
+      case SYS_MMAP:
+        sys_mmap (f, (int)args[0], (void *)args[1]);
+        break;
+      case SYS_MUNMAP:
+        sys_munmap (f, (mapid_t)args[0]);
+        break;
       default:
         exit_on (f, true); /* Unimplemented syscall --
                               force the thread to exit. */
@@ -162,7 +169,8 @@ is_valid_ptr (const void *ptr)
 {
   return (ptr != NULL) &&
     (is_user_vaddr(ptr)) &&
-    (pagedir_get_page (thread_current ()->pagedir, ptr) != NULL);
+    (pagedir_get_page (thread_current ()->pagedir, ptr) != NULL
+     || page_is_mapped (&thread_current ()->h, ptr));
 }
 
 /* Returns true iff every address within the range
@@ -251,37 +259,29 @@ sys_create (struct intr_frame *f, const char *file,
   unsigned initial_size)
 {
   exit_on (f, !is_valid_string (file));
-  lock_acquire (&filesys_lock);
   f->eax = filesys_create (file, initial_size);
-  lock_release (&filesys_lock);
 }
 
 static void
 sys_remove (struct intr_frame *f, const char *file)
 {
   exit_on (f, !is_valid_string (file));
-  lock_acquire (&filesys_lock);
   f->eax = filesys_remove (file);
-  lock_release (&filesys_lock);
 }
 
 static void
 sys_open (struct intr_frame *f, const char *file)
 {
   exit_on (f, !is_valid_string (file));
-  lock_acquire (&filesys_lock);
   f->eax = fd_table_open (file);
-  lock_release (&filesys_lock);
 }
 
 static void
 sys_filesize (struct intr_frame *f, int fd)
 {
-  lock_acquire (&filesys_lock);
   struct file *file = fd_table_get_file (fd);
-  exit_on_file (f, file == NULL);
+  exit_on (f, file == NULL);
   f->eax = file_length (file);
-  lock_release (&filesys_lock);
 }
 
 static void
@@ -302,25 +302,36 @@ sys_read (struct intr_frame *f, int fd, void *buffer,
       f->eax = length;
     }
 
-  /* Otherwise, fetch the file and read the data in. */
+  /* Otherwise, fetch the file and read the data in.  The data
+     goes through a kernel bounce page, so that a fault on the user
+     buffer never happens inside the file system, where it could
+     need the same locks as the read itself. */
   else
     {
       size_t tmp;
       size_t read_bytes = 0;
-      lock_acquire (&filesys_lock);
+      uint8_t *bounce;
       struct file *file = fd_table_get_file (fd);
-      exit_on_file (f, file == NULL);
+      exit_on (f, file == NULL);
+      if (inode_is_dir (file_get_inode (file))
+          || (bounce = palloc_get_page (0)) == NULL)
+        {
+          f->eax = -1;
+          return;
+        }
       while (read_bytes < length)
         {
-          tmp = file_read (file, (uint8_t *)buffer + read_bytes,
-            length - read_bytes);
+          size_t chunk = length - read_bytes < PGSIZE
+                         ? length - read_bytes : PGSIZE;
+          tmp = file_read (file, bounce, chunk);
           if (tmp == 0)
             {
               break;
             }
+          memcpy ((uint8_t *)buffer + read_bytes, bounce, tmp);
           read_bytes += tmp;
         }
-      lock_release (&filesys_lock);
+      palloc_free_page (bounce);
       f->eax = read_bytes;
     }
 }
@@ -339,25 +350,34 @@ sys_write (struct intr_frame *f, int fd, const void *buffer,
       f->eax = length;
     }
 
-  /* Otherwise, fetch the file and write to it. */
+  /* Otherwise, fetch the file and write to it, through a kernel
+     bounce page for the same reason as in sys_read(). */
   else
     {
       size_t tmp;
       size_t written_bytes = 0;
-      lock_acquire (&filesys_lock);
+      uint8_t *bounce;
       struct file *file = fd_table_get_file (fd);
-      exit_on_file (f, file == NULL);
+      exit_on (f, file == NULL);
+      if (inode_is_dir (file_get_inode (file))
+          || (bounce = palloc_get_page (0)) == NULL)
+        {
+          f->eax = -1;
+          return;
+        }
       while (written_bytes < length)
         {
-          tmp = file_write (file, (uint8_t *)buffer + written_bytes,
-            length - written_bytes);
-          if (tmp == 0)
+          size_t chunk = length - written_bytes < PGSIZE
+                         ? length - written_bytes : PGSIZE;
+          memcpy (bounce, (const uint8_t *)buffer + written_bytes, chunk);
+          tmp = file_write (file, bounce, chunk);
+          written_bytes += tmp;
+          if (tmp < chunk)
             {
               break;
             }
-          written_bytes += tmp;
         }
-      lock_release (&filesys_lock);
+      palloc_free_page (bounce);
       f->eax = written_bytes;
     }
 }
@@ -365,27 +385,100 @@ sys_write (struct intr_frame *f, int fd, const void *buffer,
 static void
 sys_seek (struct intr_frame *f, int fd, unsigned position)
 {
-  lock_acquire (&filesys_lock);
   struct file *file = fd_table_get_file (fd);
-  exit_on_file (f, file == NULL);
+  exit_on (f, file == NULL);
   file_seek (file, position);
-  lock_release (&filesys_lock);
 }
 
 static void
 sys_tell (struct intr_frame *f, int fd)
 {
-  lock_acquire (&filesys_lock);
   struct file *file = fd_table_get_file (fd);
-  exit_on_file (f, file == NULL);
+  exit_on (f, file == NULL);
   f->eax = file_tell (file);
-  lock_release (&filesys_lock);
 }
 
 static void
 sys_close (struct intr_frame *f, int fd)
 {
-  lock_acquire (&filesys_lock);
-  exit_on_file (f, !fd_table_close (fd));
-  lock_release (&filesys_lock);
+  exit_on (f, !fd_table_close (fd));
+}
+
+static void
+sys_mmap (struct intr_frame *f, int fd, void *addr)
+{
+  struct file *file = fd_table_get_file (fd);
+  if (file == NULL || inode_is_dir (file_get_inode (file)))
+    {
+      f->eax = MAP_FAILED;
+      return;
+    }
+  f->eax = mmap_map (file, addr);
+}
+
+static void
+sys_munmap (struct intr_frame *f, mapid_t mapping)
+{
+  exit_on (f, !mmap_unmap (mapping));
+}
+
+static void
+sys_chdir (struct intr_frame *f, const char *dir)
+{
+  exit_on (f, !is_valid_string (dir));
+  f->eax = filesys_chdir (dir);
+}
+
+static void
+sys_mkdir (struct intr_frame *f, const char *dir)
+{
+  exit_on (f, !is_valid_string (dir));
+  f->eax = filesys_mkdir (dir);
+}
+
+/* Reads the next entry of the directory open as FD into NAME.
+   The directory's read position is kept as the file position
+   of FD, so successive calls walk the whole directory. */
+static void
+sys_readdir (struct intr_frame *f, int fd, char *name)
+{
+  exit_on (f, !is_valid_range (name, READDIR_MAX_LEN + 1));
+  struct file *file = fd_table_get_file (fd);
+  exit_on (f, file == NULL);
+
+  /* The entry is read into kernel memory first, because the
+     directory is locked while it is read. */
+  char entry[READDIR_MAX_LEN + 1];
+  bool success = false;
+  struct inode *inode = file_get_inode (file);
+  if (inode_is_dir (inode))
+    {
+      struct dir *dir = dir_open (inode_reopen (inode));
+      if (dir != NULL)
+        {
+          dir_seek (dir, file_tell (file));
+          success = dir_readdir (dir, entry);
+          file_seek (file, dir_tell (dir));
+          dir_close (dir);
+        }
+    }
+  if (success)
+    strlcpy (name, entry, READDIR_MAX_LEN + 1);
+  f->eax = success;
+}
+
+static void
+sys_isdir (struct intr_frame *f, int fd)
+{
+  struct file *file = fd_table_get_file (fd);
+  exit_on (f, file == NULL);
+  f->eax = inode_is_dir (file_get_inode (file));
+}
+
+static void
+sys_inumber (struct intr_frame *f, int fd)
+{
+  struct file *file = fd_table_get_file (fd);
+  exit_on (f, file == NULL);
+  f->eax = inode_get_inumber (file_get_inode (file));
 }
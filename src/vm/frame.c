@@ -1,42 +1,580 @@
 #include "lib/stdint.h"
 #include "lib/debug.h"
+#include "lib/kernel/hash.h"
 #include "lib/kernel/list.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 #include "vm/frame.h"
+#include "vm/page.h"
+
+/* The frame table records, for every user pool page in use, the
+   user pages mapped to it.  When the user pool runs dry, a clock
+   hand sweeps the table looking for a frame whose pages have not
+   been accessed since the hand last passed it, and asks the page
+   table to evict those pages so the frame can be reused.
+
+   Most frames are mapped by a single user page.  A read-only
+   page of file data, such as a page of program text, is instead
+   looked up by file position in a table of shared frames, so
+   that every process running the same executable maps the same
+   frame.  Such a frame is freed when its last user unmaps it.
+
+   Evicting a page may mean writing it to swap, so the frame table
+   lock is dropped while the page table evicts the pages of the
+   chosen frame.  The frame is marked as being evicted meanwhile,
+   and anyone who needs one of its pages waits for the eviction to
+   finish. */
 
 static struct list ftable;
+static struct list_elem *hand;  /* Clock hand, or list end. */
+static struct hash frames;      /* All frames by kernel address. */
+static struct hash shared;      /* Shared frames by file position. */
+static struct lock ftable_lock; /* Protects ftable, hand, frames,
+                                   shared. */
+static struct list evicting;    /* Frames being evicted. */
+static struct condition loaded; /* Signaled when a frame is unpinned. */
+static struct condition evicted; /* Signaled when an eviction ends. */
 
 struct frame
   {
-    void *pg_addr;
+    void *pg_addr;              /* Kernel address of the frame. */
+    struct list users;          /* List of struct frame_user. */
+    int pin_cnt;                /* Frame may be evicted only if 0. */
+    bool loading;               /* True until first unpinned. */
+    bool evicting;              /* True while being evicted. */
+    struct list_elem evict_elem; /* Element in evicting. */
     struct list_elem elem; // list_elem for frame table
+    struct hash_elem kpage_elem; /* Element in frames. */
+
+    /* Shared frames only. */
+    struct inode *inode;        /* File inode, or NULL if private. */
+    off_t ofs;                  /* Offset in file. */
+    size_t len;                 /* Bytes of file data. */
+    struct hash_elem hash_elem; /* Element in shared. */
+  };
+
+/* A user page mapped to a frame. */
+struct frame_user
+  {
+    uint32_t *pagedir;          /* Page directory. */
+    void *upage;                /* User page. */
+    struct supp_pte *page;      /* Supplemental page table entry. */
+    struct list_elem elem;      /* Element in frame's users list. */
   };
 
+static hash_hash_func kpage_hash;
+static hash_less_func kpage_less;
+static hash_hash_func shared_hash;
+static hash_less_func shared_less;
+static struct frame *new_frame (void);
+static bool add_user (struct frame *, uint32_t *pd, void *upage,
+                      struct supp_pte *page);
+static void remove_frame (struct frame *);
+static struct frame *evict (void);
+static bool page_evicting (struct supp_pte *page);
+static bool pagedir_evicting (uint32_t *pd);
+
 void
 frame_table_init (void)
 {
   list_init (&ftable);
+  hash_init (&frames, kpage_hash, kpage_less, NULL);
+  hash_init (&shared, shared_hash, shared_less, NULL);
+  list_init (&evicting);
+  lock_init (&ftable_lock);
+  cond_init (&loaded);
+  cond_init (&evicted);
+  hand = list_end (&ftable);
+}
+
+/* Obtains a frame for user page UPAGE in page directory PD,
+   evicting some other page if the user pool is exhausted, and
+   returns its kernel virtual address.  PAGE is UPAGE's
+   supplemental page table entry.  The frame is returned pinned,
+   so that it cannot be evicted before the caller fills it and
+   maps it; call frame_unpin() afterward.  Returns a null pointer
+   if no frame is free and none can be evicted. */
+void *
+frame_alloc (uint32_t *pd, void *upage, struct supp_pte *page)
+{
+  struct frame *frame;
+
+  lock_acquire (&ftable_lock);
+  while (page_evicting (page))
+    cond_wait (&evicted, &ftable_lock);
+  frame = new_frame ();
+  if (frame != NULL && !add_user (frame, pd, upage, page))
+    {
+      remove_frame (frame);
+      frame = NULL;
+    }
+  lock_release (&ftable_lock);
+
+  return frame != NULL ? frame->pg_addr : NULL;
 }
 
+/* Like frame_alloc(), but for a read-only page whose contents are
+   LEN bytes of INODE starting at offset OFS, followed by zeroes.
+   If another process has already loaded those bytes into a frame,
+   maps UPAGE to that frame too and sets *FRESH to false; otherwise
+   obtains a new frame for the caller to fill and sets *FRESH to
+   true.  Either way the frame is returned pinned. */
 void *
-frame_alloc (void)
+frame_alloc_shared (struct inode *inode, off_t ofs, size_t len,
+                    uint32_t *pd, void *upage, struct supp_pte *page,
+                    bool *fresh)
 {
-  void *page = palloc_get_page (PAL_USER);
-  
-  ASSERT (page != NULL); // TODO: implement swapping
+  struct frame key, *frame;
+  struct hash_elem *e;
+
+  key.inode = inode;
+  key.ofs = ofs;
+  key.len = len;
+
+  lock_acquire (&ftable_lock);
+  while (page_evicting (page))
+    cond_wait (&evicted, &ftable_lock);
+  for (;;)
+    {
+      e = hash_find (&shared, &key.hash_elem);
+      if (e == NULL)
+        break;
+      frame = hash_entry (e, struct frame, hash_elem);
+      if (!frame->loading)
+        break;
+
+      /* Someone else is reading the page in.  Wait for them to
+         finish, then look again in case they failed. */
+      cond_wait (&loaded, &ftable_lock);
+    }
+
+  if (e != NULL)
+    {
+      *fresh = false;
+      if (add_user (frame, pd, upage, page))
+        frame->pin_cnt++;
+      else
+        frame = NULL;
+    }
+  else
+    {
+      *fresh = true;
+      frame = new_frame ();
+      if (frame != NULL)
+        {
+          if (add_user (frame, pd, upage, page))
+            {
+              frame->inode = inode;
+              frame->ofs = ofs;
+              frame->len = len;
+              hash_insert (&shared, &frame->hash_elem);
+            }
+          else
+            {
+              remove_frame (frame);
+              frame = NULL;
+            }
+        }
+    }
+  lock_release (&ftable_lock);
 
-  // now record this in our frame table
-  struct frame *frame = malloc (sizeof (struct frame));
-  frame->pg_addr = page;
-  list_push_back (&ftable, &frame->elem); // add frame to our frame table
+  return frame != NULL ? frame->pg_addr : NULL;
+}
+
+/* Returns the frame whose kernel address is KPAGE.
+   The frame table lock must be held. */
+static struct frame *
+frame_lookup (void *kpage)
+{
+  struct frame key;
+  struct hash_elem *e;
 
-  return page;
+  key.pg_addr = kpage;
+  e = hash_find (&frames, &key.kpage_elem);
+  ASSERT (e != NULL);
+  return hash_entry (e, struct frame, kpage_elem);
 }
 
+/* If user page UPAGE in PD is in memory, pins the frame it is
+   mapped to and returns the frame's kernel address, which the
+   caller may then use until it calls frame_unpin() or
+   frame_free().  Returns a null pointer if UPAGE is not in
+   memory.  PAGE is UPAGE's supplemental page table entry.  If
+   UPAGE is being evicted, waits for the eviction to finish
+   first, so that the caller finds PAGE either in memory or
+   fully swapped out. */
+void *
+frame_pin (uint32_t *pd, void *upage, struct supp_pte *page)
+{
+  void *kpage;
+
+  lock_acquire (&ftable_lock);
+  while (page_evicting (page))
+    cond_wait (&evicted, &ftable_lock);
+  for (;;)
+    {
+      struct frame *frame;
+
+      kpage = pagedir_get_page (pd, upage);
+      if (kpage == NULL)
+        break;
+      frame = frame_lookup (kpage);
+      if (!frame->evicting)
+        {
+          frame->pin_cnt++;
+          break;
+        }
+      cond_wait (&evicted, &ftable_lock);
+    }
+  lock_release (&ftable_lock);
+
+  return kpage;
+}
+
+/* Undoes one pinning of the frame at KPAGE by frame_alloc() or
+   frame_alloc_shared(), making it eligible for eviction once no
+   pins remain. */
 void
-frame_free (void *page) {
-  palloc_free_page (page);
-  // TODO
+frame_unpin (void *kpage)
+{
+  struct frame *frame;
+
+  lock_acquire (&ftable_lock);
+  frame = frame_lookup (kpage);
+  ASSERT (frame->pin_cnt > 0);
+  frame->pin_cnt--;
+  if (frame->loading)
+    {
+      frame->loading = false;
+      cond_broadcast (&loaded, &ftable_lock);
+    }
+  lock_release (&ftable_lock);
+}
+
+/* Removes the mapping of UPAGE in PD from FRAME, clearing it in
+   PD, and frees FRAME if that was its last user.  The frame table
+   lock must be held. */
+static void
+remove_user (struct frame *frame, uint32_t *pd, void *upage)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&frame->users); e != list_end (&frame->users);
+       e = list_next (e))
+    {
+      struct frame_user *user = list_entry (e, struct frame_user, elem);
+      if (user->pagedir == pd && user->upage == upage)
+        {
+          pagedir_clear_page (pd, upage);
+          list_remove (&user->elem);
+          free (user);
+          break;
+        }
+    }
+  if (list_empty (&frame->users))
+    remove_frame (frame);
+}
+
+/* Drops the mapping of UPAGE in PD from the frame at KPAGE, which
+   the caller must have pinned, and frees the frame if that was
+   its last user.  The pin is dropped too. */
+void
+frame_free (void *kpage, uint32_t *pd, void *upage)
+{
+  struct frame *frame;
+
+  lock_acquire (&ftable_lock);
+  frame = frame_lookup (kpage);
+  ASSERT (frame->pin_cnt > 0);
+  frame->pin_cnt--;
+  if (frame->loading)
+    {
+      /* Loading failed.  Let any waiters try for themselves. */
+      frame->loading = false;
+      cond_broadcast (&loaded, &ftable_lock);
+    }
+  remove_user (frame, pd, upage);
+  lock_release (&ftable_lock);
+}
+
+/* Unmaps every frame mapped in page directory PD, freeing those
+   that nothing else maps.  Call this before destroying PD, which
+   would otherwise free the frames behind the frame table's back. */
+void
+frame_free_all (uint32_t *pd)
+{
+  struct list_elem *e, *u;
+
+  lock_acquire (&ftable_lock);
+  while (pagedir_evicting (pd))
+    cond_wait (&evicted, &ftable_lock);
+  for (e = list_begin (&ftable); e != list_end (&ftable); )
+    {
+      struct frame *frame = list_entry (e, struct frame, elem);
+      e = list_next (e);
+      for (u = list_begin (&frame->users); u != list_end (&frame->users); )
+        {
+          struct frame_user *user = list_entry (u, struct frame_user, elem);
+          u = list_next (u);
+          if (user->pagedir == pd)
+            {
+              /* May free FRAME, but E has already moved past it. */
+              remove_user (frame, pd, user->upage);
+              break;
+            }
+        }
+    }
+  lock_release (&ftable_lock);
+}
+
+/* Returns a frame with no users, taken from the user pool if
+   possible and by eviction otherwise, or a null pointer if
+   neither works.  The frame table lock must be held. */
+static struct frame *
+new_frame (void)
+{
+  struct frame *frame;
+  void *kpage = palloc_get_page (PAL_USER);
+
+  if (kpage == NULL)
+    frame = evict ();
+  else
+    {
+      // now record this in our frame table
+      frame = malloc (sizeof (struct frame));
+      if (frame == NULL)
+        {
+          palloc_free_page (kpage);
+          return NULL;
+        }
+      frame->pg_addr = kpage;
+      list_init (&frame->users);
+      list_push_back (&ftable, &frame->elem); // add frame to our frame table
+      hash_insert (&frames, &frame->kpage_elem);
+    }
+  if (frame != NULL)
+    {
+      frame->pin_cnt = 1;
+      frame->loading = true;
+      frame->evicting = false;
+      frame->inode = NULL;
+    }
+  return frame;
+}
+
+/* Records that UPAGE in PD, with supplemental page table entry
+   PAGE, is mapped to FRAME.  Returns false if out of memory.
+   The frame table lock must be held. */
+static bool
+add_user (struct frame *frame, uint32_t *pd, void *upage,
+          struct supp_pte *page)
+{
+  struct frame_user *user = malloc (sizeof *user);
+  if (user == NULL)
+    return false;
+  user->pagedir = pd;
+  user->upage = upage;
+  user->page = page;
+  list_push_back (&frame->users, &user->elem);
+  return true;
+}
+
+/* Removes FRAME, which must have no users, from the frame table,
+   moving the clock hand off it first, and frees it.  The frame
+   table lock must be held. */
+static void
+remove_frame (struct frame *frame)
+{
+  ASSERT (list_empty (&frame->users));
+
+  if (hand == &frame->elem)
+    hand = list_next (hand);
+  list_remove (&frame->elem);
+  hash_delete (&frames, &frame->kpage_elem);
+  if (frame->inode != NULL)
+    hash_delete (&shared, &frame->hash_elem);
+  palloc_free_page (frame->pg_addr);
+  free (frame);
+}
+
+/* Returns true if any page mapped to FRAME has been accessed, and
+   clears all their accessed bits. */
+static bool
+test_and_clear_accessed (struct frame *frame)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  for (e = list_begin (&frame->users); e != list_end (&frame->users);
+       e = list_next (e))
+    {
+      struct frame_user *user = list_entry (e, struct frame_user, elem);
+      if (pagedir_is_accessed (user->pagedir, user->upage))
+        {
+          pagedir_set_accessed (user->pagedir, user->upage, false);
+          accessed = true;
+        }
+    }
+  return accessed;
+}
+
+/* Evicts every page mapped to FRAME, with the frame table lock
+   released while the page table does so, and returns true if
+   successful.  Only a private frame can fail to be evicted, so a
+   frame is never left partly evicted.  The frame table lock must
+   be held. */
+static bool
+evict_users (struct frame *frame)
+{
+  struct list_elem *e;
+  bool success = true;
+
+  /* Nobody may join a shared frame that is on its way out. */
+  if (frame->inode != NULL)
+    {
+      hash_delete (&shared, &frame->hash_elem);
+      frame->inode = NULL;
+    }
+
+  /* While FRAME is marked, no one else changes its users. */
+  frame->evicting = true;
+  list_push_back (&evicting, &frame->evict_elem);
+  lock_release (&ftable_lock);
+
+  for (e = list_begin (&frame->users); e != list_end (&frame->users);
+       e = list_next (e))
+    {
+      struct frame_user *user = list_entry (e, struct frame_user, elem);
+      if (!page_evict (user->page, user->pagedir, frame->pg_addr))
+        {
+          ASSERT (list_size (&frame->users) == 1);
+          success = false;
+          break;
+        }
+    }
+
+  lock_acquire (&ftable_lock);
+  list_remove (&frame->evict_elem);
+  frame->evicting = false;
+  if (success)
+    while (!list_empty (&frame->users))
+      free (list_entry (list_pop_front (&frame->users),
+                        struct frame_user, elem));
+  cond_broadcast (&evicted, &ftable_lock);
+  return success;
+}
+
+/* Returns true if supplemental page table entry PAGE belongs to
+   a frame being evicted.  The frame table lock must be held. */
+static bool
+page_evicting (struct supp_pte *page)
+{
+  struct list_elem *e, *u;
+
+  for (e = list_begin (&evicting); e != list_end (&evicting);
+       e = list_next (e))
+    {
+      struct frame *frame = list_entry (e, struct frame, evict_elem);
+      for (u = list_begin (&frame->users); u != list_end (&frame->users);
+           u = list_next (u))
+        if (list_entry (u, struct frame_user, elem)->page == page)
+          return true;
+    }
+  return false;
+}
+
+/* Returns true if a frame being evicted is mapped in page
+   directory PD.  The frame table lock must be held. */
+static bool
+pagedir_evicting (uint32_t *pd)
+{
+  struct list_elem *e, *u;
+
+  for (e = list_begin (&evicting); e != list_end (&evicting);
+       e = list_next (e))
+    {
+      struct frame *frame = list_entry (e, struct frame, evict_elem);
+      for (u = list_begin (&frame->users); u != list_end (&frame->users);
+           u = list_next (u))
+        if (list_entry (u, struct frame_user, elem)->pagedir == pd)
+          return true;
+    }
+  return false;
+}
+
+/* Sweeps the clock hand around the frame table to choose a frame
+   to reuse, and evicts its pages.  A frame whose pages have been
+   accessed gets a second chance: their accessed bits are cleared
+   and the hand moves on.  Gives up, returning a null pointer,
+   after two full turns without finding a frame that can be
+   evicted.  The frame table lock must be held; it is released
+   while pages are being evicted. */
+static struct frame *
+evict (void)
+{
+  size_t steps = 2 * list_size (&ftable);
+
+  while (steps-- > 0)
+    {
+      struct frame *frame;
+
+      if (hand == list_end (&ftable))
+        hand = list_begin (&ftable);
+      if (hand == list_end (&ftable))
+        break;
+      frame = list_entry (hand, struct frame, elem);
+      hand = list_next (hand);
+
+      if (frame->pin_cnt > 0 || frame->evicting
+          || test_and_clear_accessed (frame))
+        continue;
+      if (evict_users (frame))
+        return frame;
+    }
+  return NULL;
+}
+
+/* Returns a hash of frame E's kernel address. */
+static unsigned
+kpage_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *frame = hash_entry (e, struct frame, kpage_elem);
+  return hash_bytes (&frame->pg_addr, sizeof frame->pg_addr);
+}
+
+/* Orders frames A and B by kernel address. */
+static bool
+kpage_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, kpage_elem);
+  const struct frame *b = hash_entry (b_, struct frame, kpage_elem);
+
+  return a->pg_addr < b->pg_addr;
+}
+
+/* Returns a hash of shared frame E's file position. */
+static unsigned
+shared_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *frame = hash_entry (e, struct frame, hash_elem);
+  return hash_bytes (&frame->inode, sizeof frame->inode) ^ hash_int (frame->ofs);
+}
+
+/* Orders shared frames A and B by file position. */
+static bool
+shared_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, hash_elem);
+  const struct frame *b = hash_entry (b_, struct frame, hash_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->len < b->len;
 }
@@ -1,13 +1,41 @@
 #ifndef VM_FRAME_H
 #define VM_FRAME_H
 
-// grab a new frame and return the address
-void *frame_alloc (void);
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
 
-// free the frame pointed at by page
-void frame_free (void *page);
+struct inode;
+struct supp_pte;
 
 // initialize the frame table
 void frame_table_init (void);
 
+// grab a new frame for user page UPAGE in page directory PD, evicting
+// another page if memory is full, and return its kernel address
+void *frame_alloc (uint32_t *pd, void *upage, struct supp_pte *page);
+
+// like frame_alloc, but for a read-only page holding LEN bytes of INODE
+// from offset OFS: share the frame that already holds them, if any
+void *frame_alloc_shared (struct inode *inode, off_t ofs, size_t len,
+                          uint32_t *pd, void *upage, struct supp_pte *page,
+                          bool *fresh);
+
+// pin the frame that upage in pd is mapped to and return its kernel
+// address, or return NULL if upage isn't in memory; waits out an
+// eviction of page, upage's supplemental page table entry, first
+void *frame_pin (uint32_t *pd, void *upage, struct supp_pte *page);
+
+// allow the frame pointed at by kpage to be evicted
+void frame_unpin (void *kpage);
+
+// drop the mapping of upage in pd from the frame pointed at by page,
+// freeing the frame if nothing else maps it
+void frame_free (void *page, uint32_t *pd, void *upage);
+
+// unmap every frame mapped in page directory pd, freeing the ones
+// nothing else maps
+void frame_free_all (uint32_t *pd);
+
 #endif
@@ -0,0 +1,111 @@
+#include "vm/mmap.h"
+#include "lib/debug.h"
+#include "lib/round.h"
+#include "lib/kernel/list.h"
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+/* A file mapped into memory is entered page by page in the
+ * supplemental page table, so that each page is read from the
+ * file when it is first touched, just like a page of an
+ * executable.  The mapping keeps its own handle on the file, so
+ * it outlives the file descriptor it was made from.
+ */
+
+// a file mapping, kept in its process's list of mappings
+struct mapping {
+	mapid_t id;
+	struct file *file;
+	void *addr; // first page
+	size_t page_cnt;
+	struct list_elem elem;
+};
+
+static void unmap (struct mapping *m);
+
+mapid_t mmap_map (struct file *file, void *addr) {
+	struct thread *t = thread_current ();
+
+	off_t length = file_length (file);
+	if (length == 0 || addr == NULL || pg_ofs (addr) != 0) {
+		return MAP_FAILED;
+	}
+
+	// every page must be free user address space
+	size_t page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	size_t i;
+	for (i = 0; i < page_cnt; i++) {
+		void *upage = (uint8_t *) addr + i * PGSIZE;
+		if (!is_user_vaddr (upage)
+			|| pagedir_get_page (t->pagedir, upage) != NULL
+			|| page_is_mapped (&t->h, upage)) {
+			return MAP_FAILED;
+		}
+	}
+
+	struct mapping *m = malloc (sizeof (struct mapping));
+	if (!m) {
+		return MAP_FAILED;
+	}
+	m->file = file_reopen (file);
+	if (!m->file) {
+		free (m);
+		return MAP_FAILED;
+	}
+	m->id = t->next_mapid++;
+	m->addr = addr;
+	m->page_cnt = 0;
+	list_push_back (&t->mappings, &m->elem);
+
+	for (i = 0; i < page_cnt; i++) {
+		off_t start = i * PGSIZE;
+		size_t read_bytes = length - start < PGSIZE ? length - start : PGSIZE;
+		if (!page_alloc_mmap (&t->h, (uint8_t *) addr + start, m->file,
+							  start, read_bytes)) {
+			unmap (m);
+			return MAP_FAILED;
+		}
+		m->page_cnt++;
+	}
+	return m->id;
+}
+
+bool mmap_unmap (mapid_t id) {
+	struct thread *t = thread_current ();
+	struct list_elem *e;
+
+	for (e = list_begin (&t->mappings); e != list_end (&t->mappings);
+		 e = list_next (e)) {
+		struct mapping *m = list_entry (e, struct mapping, elem);
+		if (m->id == id) {
+			unmap (m);
+			return true;
+		}
+	}
+	return false;
+}
+
+void mmap_unmap_all (void) {
+	struct thread *t = thread_current ();
+
+	while (!list_empty (&t->mappings)) {
+		unmap (list_entry (list_front (&t->mappings), struct mapping, elem));
+	}
+}
+
+// free m's pages, writing back the ones that changed, and then m itself
+static void unmap (struct mapping *m) {
+	struct thread *t = thread_current ();
+	size_t i;
+
+	for (i = 0; i < m->page_cnt; i++) {
+		page_free (&t->h, (uint8_t *) m->addr + i * PGSIZE);
+	}
+	list_remove (&m->elem);
+	file_close (m->file);
+	free (m);
+}
@@ -0,0 +1,17 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+#include "lib/user/syscall.h"
+
+struct file;
+
+// map the whole of file into memory starting at addr, returning the new mapping's id
+mapid_t mmap_map (struct file *file, void *addr);
+
+// remove mapping id, writing changed pages back to its file
+bool mmap_unmap (mapid_t id);
+
+// remove every mapping of the current process
+void mmap_unmap_all (void);
+
+#endif /* VM_MMAP_H */
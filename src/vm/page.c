@@ -4,6 +4,8 @@
 #include "lib/stdbool.h"
 #include "lib/debug.h"
 #include "lib/kernel/hash.h"
+#include "devices/block.h"
+#include "filesys/file.h"
 #include "filesys/off_t.h"
 #include "threads/vaddr.h"
 #include "threads/thread.h"
@@ -11,6 +13,7 @@
 #include "threads/palloc.h"
 #include "userprog/pagedir.h"
 #include "vm/frame.h"
+#include "vm/swap.h"
 
 // where is the data?
 enum data_loc {
@@ -25,7 +28,7 @@ bool supp_pt_less_func (const struct hash_elem *a,
 					 void *aux);
 bool page_table_init (struct hash *h);
 struct supp_pte *supp_pte_lookup (struct hash *h, void *address);
-void supp_pte_fetch (struct hash *h, struct supp_pte *e, void *kpage);
+bool supp_pte_fetch (struct hash *h, struct supp_pte *e, void *kpage);
 
 // struct for an entry in the supplemental page table
 struct supp_pte {
@@ -37,10 +40,11 @@ struct supp_pte {
 	// if the page should be in memory, we need this
 	struct file *file;
 	off_t start;
+	size_t read_bytes; // the rest of the page is zeroes
+	bool mapped; // changes go back to the file when the page is freed
 
-	// if the page should be on swap, we need something like this
-	// just a placeholder for now (I don't know what it should look like)
-	void *swap;
+	// if the page is on swap, the slot it's in (SWAP_ERROR otherwise)
+	size_t swap_slot;
 
 	struct hash_elem hash_elem;
 };
@@ -55,8 +59,7 @@ bool supp_pt_less_func (const struct hash_elem *a,
 					 void *aux UNUSED) {
 	struct supp_pte *pte_a = hash_entry (a, struct supp_pte, hash_elem);
 	struct supp_pte *pte_b = hash_entry (b, struct supp_pte, hash_elem);
-	return hash_bytes (&pte_a->address, sizeof (void *)) <
-		   hash_bytes (&pte_b->address, sizeof (void *));
+	return pte_a->address < pte_b->address;
 }
 
 bool page_table_init (struct hash *h) {
@@ -72,46 +75,204 @@ struct supp_pte *supp_pte_lookup (struct hash *h, void *address) {
 	struct hash_elem *e = hash_find (h, &key->hash_elem); // find the element in our hash table corresponding to this page
 	free (key);
 
+	if (e == NULL) {
+		return NULL; // not a page we know about
+	}
 	struct supp_pte *pte = hash_entry (e, struct supp_pte, hash_elem);
 	return pte;
 }
 
-void supp_pte_fetch (struct hash *h, struct supp_pte *e, void *kpage) {
+bool supp_pte_fetch (struct hash *h, struct supp_pte *e, void *kpage) {
 	switch (e->loc) {
 		case DISK:
-			// map from disk to kpage
-			ASSERT (false);
+			if (file_read_at (e->file, kpage, e->read_bytes, e->start)
+				!= (off_t) e->read_bytes) {
+				return false;
+			}
+			memset ((uint8_t *) kpage + e->read_bytes, 0, PGSIZE - e->read_bytes);
 			break;
 		case ZEROES:
 			memset (kpage, 0, PGSIZE);
 			break;
 		case SWAP:
-			// map from swap to kpage
-			ASSERT (false);
+			// the frame now holds the only copy, so the slot can go
+			swap_in (e->swap_slot, kpage);
+			e->swap_slot = SWAP_ERROR;
 			break;
 		default:
 			// SHOULD NEVER GET HERE
 			ASSERT (false);
 			break;
 	}
+	return true;
+}
+
+// add entry e to h, failing if its page is already there
+static bool supp_pte_insert (struct hash *h, struct supp_pte *e) {
+	if (hash_insert (h, &e->hash_elem) != NULL) {
+		free (e);
+		return false;
+	}
+	return true;
 }
 
 bool page_alloc (struct hash *h, void *upage, bool writable) {
 	struct supp_pte *e = malloc (sizeof (struct supp_pte));
+	if (!e) {
+		return false;
+	}
 	e->address = upage;
+	e->writable = writable;
 	e->loc = ZEROES;
+	e->swap_slot = SWAP_ERROR;
 
-	hash_insert (h, &e->hash_elem);
-	return true;
+	return supp_pte_insert (h, e);
+}
+
+static bool file_pte_alloc (struct hash *h, void *upage, struct file *file,
+							off_t start, size_t read_bytes, bool writable,
+							bool mapped) {
+	ASSERT (read_bytes <= PGSIZE);
+
+	struct supp_pte *e = malloc (sizeof (struct supp_pte));
+	if (!e) {
+		return false;
+	}
+	e->address = upage;
+	e->writable = writable;
+	e->loc = DISK;
+	e->file = file;
+	e->start = start;
+	e->read_bytes = read_bytes;
+	e->mapped = mapped;
+	e->swap_slot = SWAP_ERROR;
+
+	return supp_pte_insert (h, e);
+}
+
+bool page_alloc_file (struct hash *h, void *upage, struct file *file,
+					  off_t start, size_t read_bytes, bool writable) {
+	return file_pte_alloc (h, upage, file, start, read_bytes, writable, false);
+}
+
+bool page_alloc_mmap (struct hash *h, void *upage, struct file *file,
+					  off_t start, size_t read_bytes) {
+	return file_pte_alloc (h, upage, file, start, read_bytes, true, true);
 }
 
 bool page_handle_fault (struct hash *h, void *upage) {
+	uint32_t *pd = thread_current ()->pagedir;
 	struct supp_pte *e = supp_pte_lookup (h, upage);
-	void *kpage = frame_alloc ();
+	if (!e) {
+		return false;
+	}
+
+	// read-only file data is the same in every process that maps it, so
+	// share one frame between them all (and only read it in once)
+	void *kpage;
+	bool fresh = true;
+	if (e->loc == DISK && !e->writable) {
+		kpage = frame_alloc_shared (file_get_inode (e->file), e->start,
+									e->read_bytes, pd, upage, e, &fresh);
+	} else {
+		kpage = frame_alloc (pd, upage, e);
+	}
 	if (!kpage) {
 		return false;
 	}
 
-	supp_pte_fetch (h, e, kpage);
-	return pagedir_set_page (thread_current ()->pagedir, upage, kpage, e->writable);
+	if ((fresh && !supp_pte_fetch (h, e, kpage))
+		|| !pagedir_set_page (pd, upage, kpage, e->writable)) {
+		frame_free (kpage, pd, upage);
+		return false;
+	}
+	frame_unpin (kpage);
+	return true;
+}
+
+// called by the frame table while frame kpage is marked as being evicted
+// (anyone faulting on e waits until we're done): give up the frame holding
+// page e in page directory pd if its data can be brought back later
+bool page_evict (struct supp_pte *e, uint32_t *pd, void *kpage) {
+	// unmap first, so the owner can't change the page while we look at it
+	pagedir_clear_page (pd, e->address);
+	bool dirty = pagedir_is_dirty (pd, e->address);
+
+	// a clean page can just be fetched again from where it came from
+	if (e->loc != SWAP && !dirty) {
+		return true;
+	}
+
+	size_t slot = swap_out (kpage);
+	if (slot == SWAP_ERROR) {
+		// swap is full: put the page back the way it was
+		pagedir_set_page (pd, e->address, kpage, e->writable);
+		pagedir_set_dirty (pd, e->address, dirty);
+		return false;
+	}
+	e->loc = SWAP;
+	e->swap_slot = slot;
+	return true;
+}
+
+// copy swapped-out mapped page e back to its file a sector at a time, so
+// that no frame is needed and the data can't be lost to a lack of memory
+static void write_back_swapped (struct supp_pte *e) {
+	uint8_t sector[BLOCK_SECTOR_SIZE];
+	size_t ofs;
+
+	for (ofs = 0; ofs < e->read_bytes; ofs += BLOCK_SECTOR_SIZE) {
+		size_t chunk = e->read_bytes - ofs;
+		if (chunk > BLOCK_SECTOR_SIZE) {
+			chunk = BLOCK_SECTOR_SIZE;
+		}
+		swap_read_sector (e->swap_slot, ofs / BLOCK_SECTOR_SIZE, sector);
+		file_write_at (e->file, sector, chunk, e->start + ofs);
+	}
+}
+
+void page_free (struct hash *h, void *upage) {
+	uint32_t *pd = thread_current ()->pagedir;
+	struct supp_pte *e = supp_pte_lookup (h, upage);
+	if (!e) {
+		return;
+	}
+
+	// a page of a file mapping that was written to (since it was last
+	// read from the file, or before it was swapped out) goes back to the
+	// file; dirty mapped pages are swapped rather than written back on
+	// eviction, because the evicting thread may hold the file's inode lock;
+	// frame_pin waits out an eviction in progress, which would otherwise
+	// still be filling in e->loc and e->swap_slot
+	void *kpage = frame_pin (pd, upage, e);
+	if (kpage) {
+		if (e->mapped && (e->loc == SWAP || pagedir_is_dirty (pd, upage))) {
+			file_write_at (e->file, kpage, e->read_bytes, e->start);
+		}
+		frame_free (kpage, pd, upage);
+	} else if (e->swap_slot != SWAP_ERROR) {
+		if (e->mapped) {
+			write_back_swapped (e);
+		}
+		swap_free (e->swap_slot);
+	}
+
+	hash_delete (h, &e->hash_elem);
+	free (e);
+}
+
+bool page_is_mapped (struct hash *h, const void *uaddr) {
+	return supp_pte_lookup (h, (void *) uaddr) != NULL;
+}
+
+static void supp_pte_destroy (struct hash_elem *e, void *aux UNUSED) {
+	struct supp_pte *pte = hash_entry (e, struct supp_pte, hash_elem);
+	if (pte->swap_slot != SWAP_ERROR) {
+		swap_free (pte->swap_slot);
+	}
+	free (pte);
+}
+
+void page_table_destroy (struct hash *h) {
+	hash_destroy (h, supp_pte_destroy);
 }
@@ -2,7 +2,12 @@
 #define VM_PAGE_H
 
 #include "lib/stdbool.h"
+#include "lib/stdint.h"
 #include "lib/kernel/hash.h"
+#include "filesys/off_t.h"
+
+struct file;
+struct supp_pte;
 
 /* On a page fault, the kernel looks up the virtual page that faulted in the
  * supplemental page table to find out what data should be there. This means
@@ -14,13 +19,32 @@
 
 bool page_table_init (struct hash *h);
 
+// free every entry in the supplemental page table and its swap slot (its frames must already be freed)
+void page_table_destroy (struct hash *h);
+
 // initialize (in the supplemental page table) a virtual page at (virtual) address upage
 bool page_alloc (struct hash *h, void *upage, bool writable);
 
+// initialize a virtual page at upage whose first read_bytes bytes are read from file at offset start
+// when it is first touched, the rest being zeroes
+bool page_alloc_file (struct hash *h, void *upage, struct file *file,
+					  off_t start, size_t read_bytes, bool writable);
+
+// initialize a writable virtual page at upage mapping read_bytes bytes of file at offset start,
+// the rest being zeroes; page_free writes changes to it back to the file
+bool page_alloc_mmap (struct hash *h, void *upage, struct file *file,
+					  off_t start, size_t read_bytes);
+
 // handle a page fault (obtain a frame, fetch the right data into the frame, point the VA to the frame, and return success)
 bool page_handle_fault (struct hash *h, void *upage);
 
-// free a virtual page with address upage
+// evict page e, mapped in page directory pd, from frame kpage; return false if it can't be evicted
+bool page_evict (struct supp_pte *e, uint32_t *pd, void *kpage);
+
+// is there a virtual page at user address uaddr?
+bool page_is_mapped (struct hash *h, const void *uaddr);
+
+// free a virtual page with address upage, writing it back first if it's a changed file mapping
 void page_free (struct hash *h, void *upage);
 
 #endif /* VM_PAGE_H */
@@ -0,0 +1,128 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The swap device is divided into page-sized slots, each holding
+   one evicted page, and a bitmap records which slots are in use.
+   A page is written out to a free slot when its frame is needed
+   for something else, and read back in, freeing the slot, the
+   next time it is touched. */
+
+/* Sectors per swap slot. */
+#define SLOT_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block *swap_device;   /* Swap device, or NULL. */
+static struct bitmap *used_slots;   /* One bit per slot, true if used. */
+static struct lock swap_lock;       /* Protects used_slots and the
+                                       statistics. */
+
+/* Statistics. */
+static long long in_cnt;            /* Pages read from swap. */
+static long long out_cnt;           /* Pages written to swap. */
+
+static void slot_buffers (void *kpage, void *buffers[]);
+static void release_slot (size_t slot);
+
+/* Sets up swapping to the block device in the swap role, if there
+   is one.  Without one, swap_out() always fails. */
+void
+swap_init (void)
+{
+  size_t slot_cnt = 0;
+
+  lock_init (&swap_lock);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device != NULL)
+    slot_cnt = block_size (swap_device) / SLOT_SECTORS;
+  used_slots = bitmap_create (slot_cnt);
+  if (used_slots == NULL)
+    PANIC ("swap bitmap creation failed--swap device is too large");
+}
+
+/* Writes the page at KPAGE to a free swap slot and returns the
+   slot's number, or SWAP_ERROR if no slot is free. */
+size_t
+swap_out (const void *kpage)
+{
+  void *buffers[SLOT_SECTORS];
+  size_t slot;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (used_slots, 0, 1, false);
+  if (slot != BITMAP_ERROR)
+    out_cnt++;
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return SWAP_ERROR;
+
+  slot_buffers ((void *) kpage, buffers);
+  block_write_multi (swap_device, slot * SLOT_SECTORS, SLOT_SECTORS,
+                     (const void *const *) buffers);
+  return slot;
+}
+
+/* Reads the page in swap slot SLOT into KPAGE and frees the
+   slot. */
+void
+swap_in (size_t slot, void *kpage)
+{
+  void *buffers[SLOT_SECTORS];
+
+  slot_buffers (kpage, buffers);
+  block_read_multi (swap_device, slot * SLOT_SECTORS, SLOT_SECTORS,
+                    buffers);
+
+  lock_acquire (&swap_lock);
+  in_cnt++;
+  release_slot (slot);
+  lock_release (&swap_lock);
+}
+
+/* Reads sector IDX of the page in swap slot SLOT into BUFFER,
+   which must have room for BLOCK_SECTOR_SIZE bytes, leaving the
+   slot allocated. */
+void
+swap_read_sector (size_t slot, size_t idx, void *buffer)
+{
+  ASSERT (idx < SLOT_SECTORS);
+  block_read (swap_device, slot * SLOT_SECTORS + idx, buffer);
+}
+
+/* Frees swap slot SLOT without reading it. */
+void
+swap_free (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  release_slot (slot);
+  lock_release (&swap_lock);
+}
+
+/* Marks swap slot SLOT free.  The swap lock must be held. */
+static void
+release_slot (size_t slot)
+{
+  ASSERT (bitmap_test (used_slots, slot));
+  bitmap_reset (used_slots, slot);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  printf ("Swap: %lld pages in, %lld pages out\n", in_cnt, out_cnt);
+}
+
+/* Fills BUFFERS with the addresses of the SLOT_SECTORS sectors
+   that make up the page at KPAGE. */
+static void
+slot_buffers (void *kpage, void *buffers[])
+{
+  size_t i;
+
+  for (i = 0; i < SLOT_SECTORS; i++)
+    buffers[i] = (uint8_t *) kpage + i * BLOCK_SECTOR_SIZE;
+}
@@ -1,6 +1,17 @@
 #ifndef VM_SWAP_H
 #define VM_SWAP_H
 
+#include <bitmap.h>
+#include <stddef.h>
 
+/* Returned by swap_out() when no swap slot is free. */
+#define SWAP_ERROR BITMAP_ERROR
+
+void swap_init (void);
+size_t swap_out (const void *kpage);
+void swap_in (size_t slot, void *kpage);
+void swap_read_sector (size_t slot, size_t idx, void *buffer);
+void swap_free (size_t slot);
+void swap_print_stats (void);
 
 #endif